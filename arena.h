@@ -0,0 +1,104 @@
+#pragma once
+
+#include "unique.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Monotonic arena: allocation bumps a pointer, nothing is ever freed on its own. Release() (or the
+// destructor) hands every block back at once. Objects living in the arena must be gone, or not
+// care about running their destructors, by then.
+class Arena {
+public:
+    static constexpr size_t kMinBlockSize = size_t(4) << 10;
+    static constexpr size_t kMaxBlockSize = size_t(1) << 20;
+
+    explicit Arena(size_t first_block_size = kMinBlockSize) : next_block_size_(first_block_size){};
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    ~Arena() {
+        Release();
+    }
+
+    // Never null: zero bytes still take one, so every call returns a distinct pointer
+    void* Allocate(size_t size, size_t align) {
+        if (size == 0) {
+            size = 1;
+        }
+        uintptr_t start = (cursor_ + align - 1) & ~(align - 1);
+        if (start + size > end_ || start < cursor_) {
+            return AllocateSlow(size, align);
+        }
+        cursor_ = start + size;
+        return reinterpret_cast<void*>(start);
+    }
+
+    // Frees every block. Later allocations start over with a fresh one.
+    void Release() {
+        while (head_) {
+            Block* prev = head_->prev;
+            ::operator delete(head_);
+            head_ = prev;
+        }
+        cursor_ = 0;
+        end_ = 0;
+        reserved_ = 0;
+    }
+
+    size_t BytesReserved() const {
+        return reserved_;
+    }
+
+private:
+    struct alignas(std::max_align_t) Block {
+        Block* prev;
+    };
+
+    // Blocks double up to kMaxBlockSize, a request that does not fit gets a block of its own size.
+    void* AllocateSlow(size_t size, size_t align) {
+        size_t needed = sizeof(Block) + size + align;
+        size_t block_size = next_block_size_ > needed ? next_block_size_ : needed;
+        if (next_block_size_ < kMaxBlockSize) {
+            next_block_size_ *= 2;
+        }
+
+        auto* block = static_cast<Block*>(::operator new(block_size));
+        block->prev = head_;
+        head_ = block;
+        reserved_ += block_size;
+        cursor_ = reinterpret_cast<uintptr_t>(block + 1);
+        end_ = reinterpret_cast<uintptr_t>(block) + block_size;
+        return Allocate(size, align);
+    }
+
+    Block* head_ = nullptr;
+    uintptr_t cursor_ = 0;
+    uintptr_t end_ = 0;
+    size_t next_block_size_;
+    size_t reserved_ = 0;
+};
+
+// Deleter for objects placed in an Arena: runs the destructor and leaves the memory to the arena.
+// Stateless, so UniquePtr<T, ArenaDelete> stays one pointer wide.
+struct ArenaDelete {
+    template <typename T>
+    void operator()(T* ptr) const {
+        if constexpr (!std::is_trivially_destructible_v<T>) {
+            ptr->~T();
+        }
+    }
+};
+
+template <typename T, typename... Args>
+UniquePtr<T, ArenaDelete> MakeUniqueIn(Arena& arena, Args&&... args) {
+    void* memory = arena.Allocate(sizeof(T), alignof(T));
+    return UniquePtr<T, ArenaDelete>(::new (memory) T(std::forward<Args>(args)...));
+};
+
+static_assert(sizeof(UniquePtr<int, ArenaDelete>) == sizeof(int*),
+              "ArenaDelete must not take space in UniquePtr");
@@ -0,0 +1,184 @@
+#pragma once
+
+#include "shared.h"
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <utility>
+
+// A SharedPtr slot that many threads may read and replace concurrently without locks.
+//
+// Split reference counting: the slot holds a pointer to a node that owns the published
+// SharedPtr, packed together with an "external" count of readers that are currently copying out
+// of that node. A reader bumps the external count (one fetch_add), copies the SharedPtr, and then
+// gives its reference back. When a writer swaps a node out, it moves the external count into the
+// node's own "internal" count, so the node is freed only after every reader that could still see
+// it has left. A Load therefore never touches a control block that may already be freed.
+//
+// The node pointer keeps the low 48 bits of the word, which assumes user-space addresses fit in
+// 48 bits: true with 4-level paging, not with 5-level paging (LA57) once the kernel hands out
+// addresses above 2^47, which Linux only does for mmap hints that ask for them. Pack asserts it.
+// The remaining 16 bits count readers in flight on one slot, so at most kMaxReaders Load /
+// CompareExchange calls may be between their fetch_add and their release at once; AddReader
+// asserts it.
+template <typename T>
+class AtomicSharedPtr {
+    struct Node {
+        explicit Node(SharedPtr<T> ptr) : value(std::move(ptr)){};
+
+        SharedPtr<T> value;
+        // Readers that left after the node was swapped out minus the external count handed over
+        // by the writer. The one who brings it to zero frees the node.
+        std::atomic<int64_t> internal{0};
+    };
+
+    static_assert(sizeof(void*) == 8, "AtomicSharedPtr packs the external count into pointer bits");
+
+    // Low 48 bits: Node*, high 16 bits: external count.
+    static constexpr int kCountShift = 48;
+    static constexpr uint64_t kOneReader = uint64_t(1) << kCountShift;
+    static constexpr uint64_t kPtrMask = kOneReader - 1;
+    static constexpr uint64_t kMaxReaders = (uint64_t(1) << (64 - kCountShift)) - 1;
+
+public:
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    AtomicSharedPtr() = default;
+    AtomicSharedPtr(SharedPtr<T> ptr) : word_(Pack(MakeNode(std::move(ptr)))){};
+
+    AtomicSharedPtr(const AtomicSharedPtr&) = delete;
+    AtomicSharedPtr& operator=(const AtomicSharedPtr&) = delete;
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Destructor
+
+    ~AtomicSharedPtr() {
+        delete Unpack(word_.load(std::memory_order_acquire));
+    };
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Atomic operations
+
+    SharedPtr<T> Load() const {
+        if (Unpack(word_.load(std::memory_order_acquire)) == nullptr) {
+            return SharedPtr<T>();
+        }
+
+        uint64_t word = AddReader();
+        Node* node = Unpack(word);
+        if (node == nullptr) {
+            ReleaseReader(word);
+            return SharedPtr<T>();
+        }
+
+        SharedPtr<T> result = node->value;
+        ReleaseReader(word);
+        return result;
+    };
+
+    void Store(SharedPtr<T> desired) {
+        Exchange(std::move(desired));
+    };
+
+    SharedPtr<T> Exchange(SharedPtr<T> desired) {
+        uint64_t old =
+            word_.exchange(Pack(MakeNode(std::move(desired))), std::memory_order_acq_rel);
+        return Retire(old, 0);
+    };
+
+    // Replaces the stored pointer with `desired` if it owns the same object as `expected` (same
+    // control block and same pointer). Otherwise loads the current value into `expected`.
+    bool CompareExchange(SharedPtr<T>& expected, SharedPtr<T> desired) {
+        Node* replacement = MakeNode(std::move(desired));
+
+        while (true) {
+            uint64_t word = AddReader();
+            Node* node = Unpack(word);
+
+            if (!SameOwner(node, expected)) {
+                expected = node ? node->value : SharedPtr<T>();
+                ReleaseReader(word);
+                delete replacement;
+                return false;
+            }
+
+            // Other readers may come and go, only a change of node makes us start over.
+            while (Unpack(word) == node) {
+                if (word_.compare_exchange_weak(word, Pack(replacement), std::memory_order_acq_rel,
+                                                std::memory_order_acquire)) {
+                    Retire(word, 1);
+                    return true;
+                }
+            }
+            ReleaseNode(node);
+        }
+    };
+
+private:
+    mutable std::atomic<uint64_t> word_{0};
+
+    static Node* MakeNode(SharedPtr<T> ptr) {
+        return ptr ? new Node(std::move(ptr)) : nullptr;
+    }
+
+    // Returns the word with this reader counted
+    uint64_t AddReader() const {
+        uint64_t old = word_.fetch_add(kOneReader, std::memory_order_acquire);
+        assert((old >> kCountShift) != kMaxReaders && "too many readers in flight on one slot");
+        return old + kOneReader;
+    }
+
+    static uint64_t Pack(Node* node) {
+        uint64_t word = reinterpret_cast<uint64_t>(node);
+        assert((word & ~kPtrMask) == 0 && "node address does not fit in 48 bits");
+        return word;
+    }
+
+    static Node* Unpack(uint64_t word) {
+        return reinterpret_cast<Node*>(word & kPtrMask);
+    }
+
+    static bool SameOwner(Node* node, const SharedPtr<T>& ptr) {
+        if (node == nullptr) {
+            return !ptr;
+        }
+        return node->value.GetBlock() == ptr.GetBlock() && node->value.Get() == ptr.Get();
+    }
+
+    // Give back the external reference taken by a reader that saw `word`.
+    void ReleaseReader(uint64_t word) const {
+        Node* node = Unpack(word);
+        while (Unpack(word) == node) {
+            if (word_.compare_exchange_weak(word, word - kOneReader, std::memory_order_release,
+                                            std::memory_order_relaxed)) {
+                return;
+            }
+        }
+        // The node was swapped out and our reference now lives in its internal count.
+        ReleaseNode(node);
+    }
+
+    static void ReleaseNode(Node* node) {
+        if (node && node->internal.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete node;
+        }
+    }
+
+    // Called by the writer that swapped `old` out of the slot. `own` is the number of external
+    // references in `old` that belong to the writer itself.
+    static SharedPtr<T> Retire(uint64_t old, int64_t own) {
+        Node* node = Unpack(old);
+        if (node == nullptr) {
+            return SharedPtr<T>();
+        }
+
+        SharedPtr<T> result = node->value;
+        int64_t readers = static_cast<int64_t>(old >> kCountShift) - own;
+        if (node->internal.fetch_add(readers, std::memory_order_acq_rel) + readers == 0) {
+            delete node;
+        }
+        return result;
+    }
+};
@@ -0,0 +1,92 @@
+// Building and tearing down a parse tree whose nodes own their children through UniquePtr:
+// one heap allocation per node (DefaultDelete) against MakeUniqueIn + ArenaDelete, where teardown
+// runs the destructors and Arena::Release() returns the memory in a few frees.
+//
+// Usage: arena [nodes] [rounds]
+
+#include "bench.h"
+
+#include "../arena.h"
+
+#include <stdlib.h>
+
+template <bool kInArena>
+struct Node {
+    using Child = UniquePtr<Node, std::conditional_t<kInArena, ArenaDelete, DefaultDelete<Node>>>;
+
+    Node(int kind, long value) : kind(kind), value(value){};
+
+    int kind;
+    long value;
+    Child left;
+    Child right;
+};
+
+// Builds a balanced tree of `nodes` nodes, the shape a parser produces for a long expression.
+template <typename NodeT, typename Make>
+typename NodeT::Child Build(size_t nodes, long& next_value, Make& make) {
+    if (nodes == 0) {
+        return typename NodeT::Child(nullptr);
+    }
+    auto node = make(static_cast<int>(nodes % 4), next_value++);
+    size_t left = (nodes - 1) / 2;
+    node->left = Build<NodeT>(left, next_value, make);
+    node->right = Build<NodeT>(nodes - 1 - left, next_value, make);
+    return node;
+}
+
+template <typename NodeT>
+long Sum(const NodeT* node) {
+    return node ? node->value + Sum(node->left.Get()) + Sum(node->right.Get()) : 0;
+}
+
+struct Timings {
+    double build_ns = 0;
+    double teardown_ns = 0;
+};
+
+template <typename NodeT, typename Make, typename Release>
+void Round(size_t nodes, Timings& timings, Make make, Release release) {
+    long next_value = 0;
+    auto start = BenchClock::now();
+    auto root = Build<NodeT>(nodes, next_value, make);
+    auto built = BenchClock::now();
+    DoNotOptimize(Sum(root.Get()));
+
+    auto teardown = BenchClock::now();
+    root.Reset();
+    release();
+    auto done = BenchClock::now();
+
+    timings.build_ns += std::chrono::duration<double, std::nano>(built - start).count();
+    timings.teardown_ns += std::chrono::duration<double, std::nano>(done - teardown).count();
+}
+
+int main(int argc, char** argv) {
+    size_t nodes = argc > 1 ? strtoul(argv[1], nullptr, 10) : 1'000'000;
+    size_t rounds = argc > 2 ? strtoul(argv[2], nullptr, 10) : 10;
+
+    using HeapNode = Node<false>;
+    using ArenaNode = Node<true>;
+
+    Timings heap;
+    for (size_t i = 0; i < rounds; ++i) {
+        Round<HeapNode>(
+            nodes, heap,
+            [](int kind, long value) { return HeapNode::Child(new HeapNode(kind, value)); }, [] {});
+    }
+
+    Timings arena_timings;
+    Arena arena;
+    for (size_t i = 0; i < rounds; ++i) {
+        Round<ArenaNode>(
+            nodes, arena_timings,
+            [&](int kind, long value) { return MakeUniqueIn<ArenaNode>(arena, kind, value); },
+            [&] { arena.Release(); });
+    }
+
+    Report("build/heap", 1, heap.build_ns, nodes * rounds);
+    Report("build/arena", 1, arena_timings.build_ns, nodes * rounds);
+    Report("teardown/heap", 1, heap.teardown_ns, nodes * rounds);
+    Report("teardown/arena", 1, arena_timings.teardown_ns, nodes * rounds);
+}
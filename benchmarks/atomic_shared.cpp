@@ -0,0 +1,70 @@
+// Read throughput of a published pointer while a few writers keep replacing it:
+// AtomicSharedPtr against a std::mutex guarding a plain SharedPtr.
+//
+// Usage: atomic_shared [readers] [writers]
+
+#include "bench.h"
+
+#include "../atomic_shared.h"
+
+#include <mutex>
+#include <stdlib.h>
+
+constexpr size_t kReadsPerThread = 2'000'000;
+
+struct Table {
+    explicit Table(size_t version) : version(version){};
+    size_t version;
+};
+
+class MutexSlot {
+public:
+    SharedPtr<Table> Load() const {
+        std::lock_guard guard(mutex_);
+        return ptr_;
+    }
+    void Store(SharedPtr<Table> ptr) {
+        std::lock_guard guard(mutex_);
+        ptr_.Swap(ptr);
+    }
+
+private:
+    mutable std::mutex mutex_;
+    SharedPtr<Table> ptr_;
+};
+
+template <typename Slot>
+void Run(const char* name, size_t readers, size_t writers) {
+    Slot slot;
+    slot.Store(MakeShared<Table>(0));
+    std::atomic<size_t> readers_left{readers};
+    std::atomic<size_t> writes{0};
+
+    double ns = RunThreads(readers + writers, [&](size_t index) {
+        if (index < readers) {
+            size_t sum = 0;
+            for (size_t i = 0; i < kReadsPerThread; ++i) {
+                sum += slot.Load()->version;
+            }
+            DoNotOptimize(sum);
+            readers_left.fetch_sub(1);
+        } else {
+            size_t version = 1;
+            while (readers_left.load(std::memory_order_relaxed) != 0) {
+                slot.Store(MakeShared<Table>(version++));
+            }
+            writes.fetch_add(version - 1);
+        }
+    });
+
+    Report(name, readers + writers, ns, kReadsPerThread * readers);
+    printf("%-40s writes=%zu\n", "", writes.load());
+}
+
+int main(int argc, char** argv) {
+    size_t readers = argc > 1 ? strtoul(argv[1], nullptr, 10) : 4;
+    size_t writers = argc > 2 ? strtoul(argv[2], nullptr, 10) : 1;
+
+    Run<AtomicSharedPtr<Table>>("AtomicSharedPtr reads", readers, writers);
+    Run<MutexSlot>("mutex + SharedPtr reads", readers, writers);
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <stdio.h>
+#include <thread>
+#include <vector>
+
+// Tiny helpers shared by the benchmarks in this directory.
+// Built by the top-level CMakeLists.txt, or by hand: g++ -O2 -std=c++17 -pthread -I.. <name>.cpp
+
+using BenchClock = std::chrono::steady_clock;
+
+// Keeps the optimizer from throwing away a computed value.
+template <typename T>
+inline void DoNotOptimize(const T& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// Runs body(thread_index) on `threads` threads released at the same moment and returns the wall
+// time in nanoseconds.
+template <typename Body>
+double RunThreads(size_t threads, Body body) {
+    std::atomic<size_t> ready{0};
+    std::atomic<bool> go{false};
+    std::vector<std::thread> workers;
+
+    for (size_t i = 0; i < threads; ++i) {
+        workers.emplace_back([&, i] {
+            ready.fetch_add(1);
+            while (!go.load(std::memory_order_acquire)) {
+            }
+            body(i);
+        });
+    }
+    while (ready.load() != threads) {
+    }
+
+    auto start = BenchClock::now();
+    go.store(true, std::memory_order_release);
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    return std::chrono::duration<double, std::nano>(BenchClock::now() - start).count();
+}
+
+inline void Report(const char* name, size_t threads, double total_ns, size_t ops) {
+    printf("%-40s threads=%-3zu %10.2f ns/op %12.0f ops/s\n", name, threads, total_ns / ops,
+           ops / (total_ns / 1e9));
+}
@@ -0,0 +1,45 @@
+// Biased against plain atomic counting.
+//
+// "owner" copies and drops the pointer on the thread that created it, the case biased counting
+// is built for. "handoff" additionally lets every other thread copy the same pointer, so their
+// updates go to the shared atomic word.
+//
+// Usage: biased [threads]
+
+#include "bench.h"
+
+#include "../shared.h"
+
+#include <stdlib.h>
+
+constexpr size_t kIterations = 5'000'000;
+
+void CopyLoop(const SharedPtr<int>& source) {
+    for (size_t i = 0; i < kIterations; ++i) {
+        SharedPtr<int> copy(source);
+        DoNotOptimize(copy.Get());
+    }
+}
+
+template <CountPolicy Policy>
+void Run(const char* owner_name, const char* handoff_name, size_t threads) {
+    double ns = RunThreads(1, [&](size_t) {
+        auto local = MakeShared<int, Policy>(42);
+        CopyLoop(local);
+    });
+    Report(owner_name, 1, ns, kIterations);
+
+    if (threads < 2) {
+        return;
+    }
+    auto ptr = MakeShared<int, Policy>(42);
+    ns = RunThreads(threads, [&](size_t) { CopyLoop(ptr); });
+    Report(handoff_name, threads, ns, kIterations * threads);
+}
+
+int main(int argc, char** argv) {
+    size_t threads = argc > 1 ? strtoul(argv[1], nullptr, 10) : 4;
+
+    Run<CountPolicy::kAtomic>("atomic/owner", "atomic/handoff", threads);
+    Run<CountPolicy::kBiased>("biased/owner", "biased/handoff", threads);
+}
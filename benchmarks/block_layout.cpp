@@ -0,0 +1,95 @@
+// Per-object overhead and pointer-chasing cost of MakeShared<int> blocks.
+//
+// "legacy" mirrors the previous control block layout (vtable pointer, two size_t counters, the
+// policy byte, the payload and a trailing is_delete_ flag) and allocates it with plain `new`.
+// "current" is MakeShared<int> with the 16-byte header, its counts read without going through
+// the ops table. Both are reached through a vector of raw block pointers, so only the blocks
+// differ. Visiting 10M of them in allocation order shows density, and a random order makes the
+// run almost entirely cache misses.
+//
+// Usage: block_layout [objects]
+
+#include "bench.h"
+
+#include "../shared.h"
+
+#include <algorithm>
+#include <random>
+#include <stdlib.h>
+
+struct LegacyBlockBase {
+    virtual ~LegacyBlockBase() = default;
+    std::atomic<size_t> strong_cnt{1};
+    std::atomic<size_t> weak_cnt{1};
+    CountPolicy policy = CountPolicy::kAtomic;
+};
+
+struct LegacyEmplaceInt : LegacyBlockBase {
+    explicit LegacyEmplaceInt(int value) : value(value){};
+    int value;
+    bool is_delete_ = false;
+};
+
+template <typename Block, typename Read>
+void Visit(const char* name, const std::vector<Block*>& blocks, Read read) {
+    std::vector<uint32_t> order(blocks.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        order[i] = i;
+    }
+
+    for (bool shuffled : {false, true}) {
+        if (shuffled) {
+            std::shuffle(order.begin(), order.end(), std::mt19937(42));
+        }
+        auto start = BenchClock::now();
+        size_t sum = 0;
+        for (uint32_t index : order) {
+            sum += read(blocks[index]);
+        }
+        DoNotOptimize(sum);
+        double ns = std::chrono::duration<double, std::nano>(BenchClock::now() - start).count();
+        printf("%-10s %-10s %8.2f ns/object\n", name, shuffled ? "random" : "sequential",
+               ns / blocks.size());
+    }
+}
+
+int main(int argc, char** argv) {
+    size_t count = argc > 1 ? strtoul(argv[1], nullptr, 10) : 10'000'000;
+
+    // glibc rounds size + 8 up to 16 bytes; the pool rounds size up to 16 bytes.
+    size_t legacy_size = sizeof(LegacyEmplaceInt);
+    size_t current_size = sizeof(ControlBlockEmplace<int>);
+    printf("legacy:  %zu byte block, ~%zu bytes on the heap\n", legacy_size,
+           (legacy_size + 8 + 15) / 16 * 16);
+    printf("current: %zu byte block (%zu byte header), %zu byte pool slot\n", current_size,
+           sizeof(ControlBlockBase), (current_size + 15) / 16 * 16);
+
+    {
+        std::vector<LegacyEmplaceInt*> blocks;
+        blocks.reserve(count);
+        for (size_t i = 0; i < count; ++i) {
+            blocks.push_back(new LegacyEmplaceInt(i));
+        }
+        Visit("legacy", blocks, [](LegacyEmplaceInt* block) {
+            return block->strong_cnt.load(std::memory_order_relaxed) + block->value;
+        });
+        for (auto* block : blocks) {
+            delete block;
+        }
+    }
+
+    {
+        std::vector<SharedPtr<int>> owners;
+        std::vector<ControlBlockEmplace<int>*> blocks;
+        owners.reserve(count);
+        blocks.reserve(count);
+        for (size_t i = 0; i < count; ++i) {
+            owners.push_back(MakeShared<int>(i));
+            blocks.push_back(static_cast<ControlBlockEmplace<int>*>(owners.back().GetBlock()));
+        }
+        Visit("current", blocks, [](ControlBlockEmplace<int>* block) {
+            uint64_t counts = block->counts.load(std::memory_order_relaxed);
+            return (counts >> ControlBlockBase::kStrongShift) + *block->GetPtr();
+        });
+    }
+}
@@ -0,0 +1,64 @@
+// Allocation and free throughput of control blocks, plus peak RSS.
+//
+// "pool" goes through MakeShared and the per-thread ControlBlockPool, "heap" builds the same
+// blocks with AllocateShared<T>(std::allocator) so every block hits the global heap. Peak RSS is
+// per process, so run each mode separately:
+//
+//     block_pool pool
+//     block_pool heap
+
+#include "bench.h"
+
+#include "../shared.h"
+
+#include <string.h>
+#include <sys/resource.h>
+
+constexpr size_t kObjects = 2'000'000;
+constexpr size_t kRounds = 5;
+
+template <typename Make>
+void Run(const char* mode, Make make) {
+    std::vector<SharedPtr<int>> objects;
+    objects.reserve(kObjects);
+
+    // Same-thread: allocate a batch, free it, repeat.
+    double alloc_ns = 0;
+    double free_ns = 0;
+    for (size_t round = 0; round < kRounds; ++round) {
+        auto start = BenchClock::now();
+        for (size_t i = 0; i < kObjects; ++i) {
+            objects.push_back(make(i));
+        }
+        auto middle = BenchClock::now();
+        objects.clear();
+        auto end = BenchClock::now();
+        alloc_ns += std::chrono::duration<double, std::nano>(middle - start).count();
+        free_ns += std::chrono::duration<double, std::nano>(end - middle).count();
+    }
+    printf("%s\n", mode);
+    Report("  allocate", 1, alloc_ns, kObjects * kRounds);
+    Report("  free (same thread)", 1, free_ns, kObjects * kRounds);
+
+    // Cross-thread: one thread allocates, another one drops everything.
+    double cross_ns = 0;
+    for (size_t round = 0; round < kRounds; ++round) {
+        for (size_t i = 0; i < kObjects; ++i) {
+            objects.push_back(make(i));
+        }
+        cross_ns += RunThreads(1, [&](size_t) { objects.clear(); });
+    }
+    Report("  free (other thread)", 1, cross_ns, kObjects * kRounds);
+
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    printf("  peak RSS: %ld KiB\n", usage.ru_maxrss);
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1 && strcmp(argv[1], "heap") == 0) {
+        Run("heap", [](size_t i) { return AllocateShared<int>(std::allocator<int>(), int(i)); });
+    } else {
+        Run("pool", [](size_t i) { return MakeShared<int>(int(i)); });
+    }
+}
@@ -0,0 +1,109 @@
+// Footprint and iteration speed of containers of SharedPtr against CompactSharedPtr.
+//
+// Both hold the same MakeShared blocks, so only the handles differ: 16 bytes against 8. Container
+// memory is counted through the containers' allocator and excludes the blocks themselves.
+// Iteration reads every object through its handle, in container order.
+//
+// Usage: compact_shared [elements]
+
+#include "bench.h"
+
+#include "../compact_shared.h"
+
+#include <stdlib.h>
+#include <unordered_map>
+
+static size_t allocated_bytes = 0;
+
+template <typename T>
+struct CountingAllocator {
+    using value_type = T;
+
+    CountingAllocator() = default;
+    template <typename U>
+    CountingAllocator(const CountingAllocator<U>&){};
+
+    T* allocate(size_t n) {
+        allocated_bytes += n * sizeof(T);
+        return std::allocator<T>().allocate(n);
+    }
+    void deallocate(T* ptr, size_t n) {
+        allocated_bytes -= n * sizeof(T);
+        std::allocator<T>().deallocate(ptr, n);
+    }
+
+    template <typename U>
+    bool operator==(const CountingAllocator<U>&) const {
+        return true;
+    }
+    template <typename U>
+    bool operator!=(const CountingAllocator<U>&) const {
+        return false;
+    }
+};
+
+struct Item {
+    explicit Item(size_t value) : value(value){};
+    size_t value;
+};
+
+template <typename Handle>
+using Vector = std::vector<Handle, CountingAllocator<Handle>>;
+
+template <typename Handle>
+using Map = std::unordered_map<size_t, Handle, std::hash<size_t>, std::equal_to<size_t>,
+                               CountingAllocator<std::pair<const size_t, Handle>>>;
+
+template <typename Handle>
+void Run(const char* name, const std::vector<SharedPtr<Item>>& items) {
+    size_t base = allocated_bytes;
+    {
+        Vector<Handle> vector;
+        vector.reserve(items.size());
+        for (const auto& item : items) {
+            vector.emplace_back(item);
+        }
+        double mib = (allocated_bytes - base) / double(1 << 20);
+
+        auto start = BenchClock::now();
+        size_t sum = 0;
+        for (const auto& handle : vector) {
+            sum += handle->value;
+        }
+        DoNotOptimize(sum);
+        double ns = std::chrono::duration<double, std::nano>(BenchClock::now() - start).count();
+        printf("%-8s vector   %8.1f MiB %8.2f ns/element\n", name, mib, ns / items.size());
+    }
+    {
+        Map<Handle> map;
+        map.reserve(items.size());
+        for (size_t i = 0; i < items.size(); ++i) {
+            map.emplace(i, items[i]);
+        }
+        double mib = (allocated_bytes - base) / double(1 << 20);
+
+        auto start = BenchClock::now();
+        size_t sum = 0;
+        for (const auto& [key, handle] : map) {
+            sum += key + handle->value;
+        }
+        DoNotOptimize(sum);
+        double ns = std::chrono::duration<double, std::nano>(BenchClock::now() - start).count();
+        printf("%-8s map      %8.1f MiB %8.2f ns/element\n", name, mib, ns / items.size());
+    }
+}
+
+int main(int argc, char** argv) {
+    size_t count = argc > 1 ? strtoul(argv[1], nullptr, 10) : 10'000'000;
+
+    std::vector<SharedPtr<Item>> items;
+    items.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        items.push_back(MakeShared<Item>(i));
+    }
+
+    printf("sizeof(SharedPtr) = %zu, sizeof(CompactSharedPtr) = %zu\n", sizeof(SharedPtr<Item>),
+           sizeof(CompactSharedPtr<Item>));
+    Run<SharedPtr<Item>>("shared", items);
+    Run<CompactSharedPtr<Item>>("compact", items);
+}
@@ -0,0 +1,208 @@
+// SharedPtr / WeakPtr / UniquePtr / IntrusivePtr against std::shared_ptr / weak_ptr / unique_ptr.
+//
+// Operations:
+//   construct   wrap a fresh `new` object (N objects kept alive in a vector)
+//   destroy     drop those N pointers, each the last owner
+//   make        MakeShared / MakeIntrusive / std::make_shared, N objects kept alive
+//   copy        copy and destroy, the object stays alive
+//   move        move out and back
+//   lock        WeakPtr::Lock / IntrusiveWeakPtr::Lock / std::weak_ptr::lock on a live object
+//   contention  copy and destroy one object from 1, 2, 4 ... max_threads threads
+//
+// libstdc++'s std::shared_ptr counts without atomics while the process has a single thread, so
+// its single-threaded rows can look cheaper than they will in a threaded program; the contention
+// rows (threads=1 included) run after a thread has been started.
+//
+// The results go to stdout as one JSON document, a line per result goes to stderr. Keep the JSON
+// of each commit and compare entries with equal operation/impl/threads.
+//
+// Usage: compare_std [max_threads] > results.json
+
+#include "bench.h"
+
+#include "../intrusive.h"
+#include "../shared.h"
+#include "../unique.h"
+#include "../weak.h"
+
+#include <memory>
+#include <stdlib.h>
+#include <string>
+
+constexpr size_t kObjects = 1'000'000;
+constexpr size_t kIterations = 10'000'000;
+
+struct Payload {
+    int value = 42;
+};
+
+struct IntrusivePayload : ThreadSafeRefCounted<IntrusivePayload> {
+    int value = 42;
+};
+
+struct WeakIntrusivePayload : WeakRefCounted<WeakIntrusivePayload> {
+    int value = 42;
+};
+
+struct Result {
+    std::string operation;
+    std::string impl;
+    size_t threads;
+    double ns_per_op;
+};
+
+std::vector<Result> results;
+
+void Record(const char* operation, const char* impl, size_t threads, double ns, size_t ops) {
+    results.push_back({operation, impl, threads, ns / ops});
+    fprintf(stderr, "%-12s %-18s threads=%-3zu %8.2f ns/op\n", operation, impl, threads, ns / ops);
+}
+
+void PrintJson(size_t max_threads) {
+    printf("{\n  \"context\": {\"compiler\": \"%s\", \"max_threads\": %zu, \"objects\": %zu, "
+           "\"iterations\": %zu},\n  \"results\": [\n",
+           __VERSION__, max_threads, kObjects, kIterations);
+    for (size_t i = 0; i < results.size(); ++i) {
+        const Result& result = results[i];
+        printf("    {\"operation\": \"%s\", \"impl\": \"%s\", \"threads\": %zu, "
+               "\"ns_per_op\": %.3f}%s\n",
+               result.operation.c_str(), result.impl.c_str(), result.threads, result.ns_per_op,
+               i + 1 < results.size() ? "," : "");
+    }
+    printf("  ]\n}\n");
+}
+
+double Since(BenchClock::time_point start) {
+    return std::chrono::duration<double, std::nano>(BenchClock::now() - start).count();
+}
+
+// Every pointer type here has operator*, which is all the loops need to keep a result alive.
+template <typename Ptr>
+const void* Raw(const Ptr& ptr) {
+    return &*ptr;
+}
+
+// "construct" and then "destroy" of the same N pointers.
+template <typename Ptr, typename Create>
+void ConstructDestroy(const char* impl, Create create) {
+    std::vector<Ptr> ptrs;
+    ptrs.reserve(kObjects);
+
+    auto start = BenchClock::now();
+    for (size_t i = 0; i < kObjects; ++i) {
+        ptrs.emplace_back(create());
+    }
+    Record("construct", impl, 1, Since(start), kObjects);
+
+    start = BenchClock::now();
+    ptrs.clear();
+    Record("destroy", impl, 1, Since(start), kObjects);
+}
+
+template <typename Ptr, typename Make>
+void MakeMany(const char* impl, Make make) {
+    std::vector<Ptr> ptrs;
+    ptrs.reserve(kObjects);
+
+    auto start = BenchClock::now();
+    for (size_t i = 0; i < kObjects; ++i) {
+        ptrs.push_back(make());
+    }
+    Record("make", impl, 1, Since(start), kObjects);
+}
+
+template <typename Ptr>
+void CopyLoop(const Ptr& source) {
+    for (size_t i = 0; i < kIterations; ++i) {
+        Ptr copy(source);
+        DoNotOptimize(Raw(copy));
+    }
+}
+
+template <typename Ptr>
+void Copy(const char* impl, const Ptr& source) {
+    auto start = BenchClock::now();
+    CopyLoop(source);
+    Record("copy", impl, 1, Since(start), kIterations);
+}
+
+template <typename Ptr>
+void Move(const char* impl, Ptr ptr) {
+    auto start = BenchClock::now();
+    for (size_t i = 0; i < kIterations; ++i) {
+        Ptr moved(std::move(ptr));
+        DoNotOptimize(Raw(moved));
+        ptr = std::move(moved);
+    }
+    Record("move", impl, 1, Since(start), 2 * kIterations);
+}
+
+template <typename Weak, typename Lock>
+void LockLoop(const char* impl, const Weak& weak, Lock lock) {
+    auto start = BenchClock::now();
+    for (size_t i = 0; i < kIterations; ++i) {
+        auto locked = lock(weak);
+        DoNotOptimize(Raw(locked));
+    }
+    Record("lock", impl, 1, Since(start), kIterations);
+}
+
+template <typename Ptr>
+void Contention(const char* impl, const Ptr& source, size_t max_threads) {
+    for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+        double ns = RunThreads(threads, [&](size_t) { CopyLoop(source); });
+        Record("contention", impl, threads, ns, kIterations * threads);
+    }
+}
+
+int main(int argc, char** argv) {
+    size_t max_threads =
+        argc > 1 ? strtoul(argv[1], nullptr, 10) : std::thread::hardware_concurrency();
+    if (max_threads == 0) {
+        max_threads = 1;
+    }
+
+    ConstructDestroy<SharedPtr<Payload>>("SharedPtr",
+                                         [] { return SharedPtr<Payload>(new Payload); });
+    ConstructDestroy<std::shared_ptr<Payload>>(
+        "std::shared_ptr", [] { return std::shared_ptr<Payload>(new Payload); });
+    ConstructDestroy<UniquePtr<Payload>>("UniquePtr",
+                                         [] { return UniquePtr<Payload>(new Payload); });
+    ConstructDestroy<std::unique_ptr<Payload>>(
+        "std::unique_ptr", [] { return std::unique_ptr<Payload>(new Payload); });
+    ConstructDestroy<IntrusivePtr<IntrusivePayload>>(
+        "IntrusivePtr", [] { return IntrusivePtr<IntrusivePayload>(new IntrusivePayload); });
+
+    MakeMany<SharedPtr<Payload>>("SharedPtr", [] { return MakeShared<Payload>(); });
+    MakeMany<std::shared_ptr<Payload>>("std::shared_ptr",
+                                       [] { return std::make_shared<Payload>(); });
+    MakeMany<IntrusivePtr<IntrusivePayload>>("IntrusivePtr",
+                                             [] { return MakeIntrusive<IntrusivePayload>(); });
+
+    auto shared = MakeShared<Payload>();
+    auto std_shared = std::make_shared<Payload>();
+    auto intrusive = MakeIntrusive<IntrusivePayload>();
+
+    Copy("SharedPtr", shared);
+    Copy("std::shared_ptr", std_shared);
+    Copy("IntrusivePtr", intrusive);
+
+    Move("SharedPtr", shared);
+    Move("std::shared_ptr", std_shared);
+    Move("UniquePtr", UniquePtr<Payload>(new Payload));
+    Move("std::unique_ptr", std::make_unique<Payload>());
+    Move("IntrusivePtr", intrusive);
+
+    LockLoop("WeakPtr", WeakPtr<Payload>(shared), [](const auto& weak) { return weak.Lock(); });
+    LockLoop("std::weak_ptr", std::weak_ptr<Payload>(std_shared),
+             [](const auto& weak) { return weak.lock(); });
+    auto watched = MakeIntrusive<WeakIntrusivePayload>();
+    LockLoop("IntrusiveWeakPtr", IntrusiveWeakPtr<WeakIntrusivePayload>(watched),
+             [](const auto& weak) { return weak.Lock(); });
+
+    Contention("SharedPtr", shared, max_threads);
+    Contention("std::shared_ptr", std_shared, max_threads);
+    Contention("IntrusivePtr", intrusive, max_threads);
+
+    PrintJson(max_threads);
+}
@@ -0,0 +1,45 @@
+// Copy/destroy throughput of SharedPtr under the two counting policies.
+//
+// "shared" variants hammer a single control block from every thread, which is only legal for the
+// atomic policy. "private" variants give each thread its own block, which shows the price of the
+// lock prefix without any cache-line ping-pong.
+
+#include "bench.h"
+
+#include "../shared.h"
+#include "../weak.h"
+
+#include <stdlib.h>
+
+constexpr size_t kIterations = 5'000'000;
+
+void CopyLoop(const SharedPtr<int>& source) {
+    for (size_t i = 0; i < kIterations; ++i) {
+        SharedPtr<int> copy(source);
+        DoNotOptimize(copy.Get());
+    }
+}
+
+int main(int argc, char** argv) {
+    size_t max_threads =
+        argc > 1 ? strtoul(argv[1], nullptr, 10) : std::thread::hardware_concurrency();
+
+    for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+        auto shared = MakeShared<int>(42);
+        Report("atomic/shared", threads,
+               RunThreads(threads, [&](size_t) { CopyLoop(shared); }),
+               kIterations * threads);
+
+        Report("atomic/private", threads, RunThreads(threads, [&](size_t) {
+                   auto local = MakeShared<int>(42);
+                   CopyLoop(local);
+               }),
+               kIterations * threads);
+
+        Report("single-threaded/private", threads, RunThreads(threads, [&](size_t) {
+                   auto local = MakeShared<int, CountPolicy::kSingleThreaded>(42);
+                   CopyLoop(local);
+               }),
+               kIterations * threads);
+    }
+}
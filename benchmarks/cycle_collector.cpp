@@ -0,0 +1,125 @@
+// Pause times of CycleCollector on a sessions <-> subscriptions graph, every session holding its
+// subscriptions and every subscription holding its session back.
+//
+//   garbage      all sessions dropped, one Collect() reclaims every cycle
+//   live         every session buffered as a candidate but still owned: tracing, no reclaim
+//   incremental  the garbage case in Collect(budget) steps, longest and mean step
+//
+// Plus what the mutators pay: copying and dropping a CollectableSharedPtr (the drop to a
+// non-zero count checks the candidate flag) against SharedPtr.
+//
+// Usage: cycle_collector [sessions] [subscriptions_per_session] [budget_us]
+
+#include "bench.h"
+
+#include "../cycle_collector.h"
+#include "../shared.h"
+
+#include <algorithm>
+#include <stdlib.h>
+
+constexpr size_t kIterations = 10'000'000;
+
+struct Subscription;
+
+struct Session {
+    void Trace(CycleTracer& tracer) const {
+        for (const auto& subscription : subscriptions) {
+            tracer.Visit(subscription);
+        }
+    }
+    std::vector<CollectableSharedPtr<Subscription>> subscriptions;
+};
+
+struct Subscription {
+    void Trace(CycleTracer& tracer) const {
+        tracer.Visit(session);
+    }
+    CollectableSharedPtr<Session> session;
+    long counter = 0;
+};
+
+std::vector<CollectableSharedPtr<Session>> BuildGraph(CycleCollector& collector, size_t sessions,
+                                                      size_t per_session) {
+    std::vector<CollectableSharedPtr<Session>> graph;
+    graph.reserve(sessions);
+    for (size_t i = 0; i < sessions; ++i) {
+        auto session = MakeCollectableIn<Session>(collector);
+        for (size_t k = 0; k < per_session; ++k) {
+            auto subscription = MakeCollectableIn<Subscription>(collector);
+            subscription->session = session;
+            session->subscriptions.push_back(std::move(subscription));
+        }
+        graph.push_back(std::move(session));
+    }
+    return graph;
+}
+
+double Since(BenchClock::time_point start) {
+    return std::chrono::duration<double, std::nano>(BenchClock::now() - start).count();
+}
+
+void ReportPause(const char* name, double ns, size_t objects) {
+    printf("%-40s %10.3f ms %10.2f ns/object\n", name, ns / 1e6, ns / objects);
+}
+
+template <typename Ptr>
+double CopyDrop(const Ptr& source) {
+    auto start = BenchClock::now();
+    for (size_t i = 0; i < kIterations; ++i) {
+        Ptr copy(source);
+        DoNotOptimize(copy.Get());
+    }
+    return Since(start);
+}
+
+int main(int argc, char** argv) {
+    size_t sessions = argc > 1 ? strtoul(argv[1], nullptr, 10) : 100'000;
+    size_t per_session = argc > 2 ? strtoul(argv[2], nullptr, 10) : 4;
+    auto budget = std::chrono::microseconds(argc > 3 ? strtoul(argv[3], nullptr, 10) : 100);
+    size_t objects = sessions * (per_session + 1);
+
+    CycleCollector collector;
+    {
+        auto graph = BuildGraph(collector, sessions, per_session);
+        graph.clear();
+        auto start = BenchClock::now();
+        size_t freed = collector.Collect();
+        ReportPause("garbage/full", Since(start), freed);
+    }
+    {
+        auto graph = BuildGraph(collector, sessions, per_session);
+        collector.Collect();  // roots left behind while building
+        for (const auto& session : graph) {
+            auto copy = session;  // the drop buffers the session
+        }
+        auto start = BenchClock::now();
+        collector.Collect();
+        ReportPause("live/full", Since(start), objects);
+    }
+    {
+        auto graph = BuildGraph(collector, sessions, per_session);
+        graph.clear();
+        double longest = 0;
+        double total = 0;
+        size_t steps = 0;
+        CollectStats stats;
+        do {
+            auto start = BenchClock::now();
+            stats = collector.Collect(budget);
+            double ns = Since(start);
+            longest = std::max(longest, ns);
+            total += ns;
+            ++steps;
+        } while (stats.pending > 0);
+        ReportPause("incremental/total", total, objects);
+        printf("%-40s %10.3f ms longest, %.3f ms mean over %zu steps (budget %lld us)\n",
+               "incremental/steps", longest / 1e6, total / steps / 1e6, steps,
+               static_cast<long long>(budget.count()));
+    }
+
+    auto collectable = MakeCollectableIn<Subscription>(collector);
+    auto shared = MakeShared<Subscription>();
+    Report("copy+drop/CollectableSharedPtr", 1, CopyDrop(collectable), kIterations);
+    Report("copy+drop/SharedPtr", 1, CopyDrop(shared), kIterations);
+}
@@ -0,0 +1,90 @@
+// Latency of dropping the last owner of a large tree (default 2^15 nodes of ~200 bytes, ~6 MiB),
+// as a latency-critical thread sees it, with a ReclaimerThread draining in the background:
+//
+//   inline            MakeShared root, the destructor runs in Reset()
+//   deferred block    MakeSharedDeferred root, Reset() queues the control block
+//   deferred unique   UniquePtr<Node, DeferredDelete<Node>> root, Reset() queues a node
+//
+// Prints percentiles and a log2 histogram of the Reset() times.
+//
+// Usage: deferred [tree_depth] [drops]
+
+#include "bench.h"
+
+#include "../deferred.h"
+
+#include <algorithm>
+#include <stdlib.h>
+#include <string>
+
+struct Node {
+    std::string payload = std::string(160, 'x');
+    SharedPtr<Node> left;
+    SharedPtr<Node> right;
+};
+
+template <typename Root, typename MakeRoot>
+Root Build(size_t depth, MakeRoot make_root) {
+    Root root = make_root();
+    std::vector<Node*> level{root.Get()};
+    for (size_t d = 1; d < depth; ++d) {
+        std::vector<Node*> next;
+        for (Node* node : level) {
+            node->left = MakeShared<Node>();
+            node->right = MakeShared<Node>();
+            next.push_back(node->left.Get());
+            next.push_back(node->right.Get());
+        }
+        level.swap(next);
+    }
+    return root;
+}
+
+double Percentile(const std::vector<double>& sorted, double p) {
+    return sorted[std::min(sorted.size() - 1, static_cast<size_t>(p * sorted.size()))];
+}
+
+void PrintHistogram(const char* name, std::vector<double> ns) {
+    std::sort(ns.begin(), ns.end());
+    printf("%-18s p50 %10.0f ns   p99 %10.0f ns   max %10.0f ns\n", name, Percentile(ns, 0.5),
+           Percentile(ns, 0.99), ns.back());
+
+    size_t buckets[64] = {};
+    for (double value : ns) {
+        size_t bucket = 0;
+        while ((uint64_t(2) << bucket) <= value) {
+            ++bucket;
+        }
+        ++buckets[bucket];
+    }
+    for (size_t bucket = 0; bucket < 64; ++bucket) {
+        if (buckets[bucket] != 0) {
+            printf("    < %12llu ns  %6zu  %s\n", (unsigned long long)(uint64_t(2) << bucket),
+                   buckets[bucket], std::string(buckets[bucket] * 60 / ns.size(), '#').c_str());
+        }
+    }
+}
+
+template <typename Root, typename MakeRoot>
+void Run(const char* name, size_t depth, size_t drops, MakeRoot make_root) {
+    std::vector<double> ns;
+    for (size_t i = 0; i < drops; ++i) {
+        Root root = Build<Root>(depth, make_root);
+        auto start = BenchClock::now();
+        root.Reset();
+        ns.push_back(std::chrono::duration<double, std::nano>(BenchClock::now() - start).count());
+    }
+    PrintHistogram(name, std::move(ns));
+}
+
+int main(int argc, char** argv) {
+    size_t depth = argc > 1 ? strtoul(argv[1], nullptr, 10) : 15;
+    size_t drops = argc > 2 ? strtoul(argv[2], nullptr, 10) : 200;
+
+    ReclaimerThread reclaimer;
+    Run<SharedPtr<Node>>("inline", depth, drops, [] { return MakeShared<Node>(); });
+    Run<SharedPtr<Node>>("deferred block", depth, drops, [] { return MakeSharedDeferred<Node>(); });
+    Run<UniquePtr<Node, DeferredDelete<Node>>>("deferred unique", depth, drops, [] {
+        return UniquePtr<Node, DeferredDelete<Node>>(new Node());
+    });
+}
@@ -0,0 +1,68 @@
+// Cost of copying SharedPtr to an EnableSharedFromThis type.
+//
+// "plain" copies a SharedPtr to a type without EnableSharedFromThis, "esft" to one with it. The two
+// should be the same: the inline weak reference is set when the object gets its control block and
+// copies never look at it. "shared-from-this" promotes the inline weak reference instead.
+//
+// Usage: esft [max_threads]
+
+#include "bench.h"
+
+#include "../shared.h"
+#include "../weak.h"
+
+#include <stdlib.h>
+
+constexpr size_t kIterations = 5'000'000;
+
+struct Plain {
+    int fd = 0;
+};
+
+struct Connection : EnableSharedFromThis<Connection> {
+    int fd = 0;
+};
+
+template <typename T>
+void CopyLoop(const SharedPtr<T>& source) {
+    for (size_t i = 0; i < kIterations; ++i) {
+        SharedPtr<T> copy(source);
+        DoNotOptimize(copy.Get());
+    }
+}
+
+void SharedFromThisLoop(Connection& connection) {
+    for (size_t i = 0; i < kIterations; ++i) {
+        SharedPtr<Connection> self = connection.SharedFromThis();
+        DoNotOptimize(self.Get());
+    }
+}
+
+int main(int argc, char** argv) {
+    size_t max_threads =
+        argc > 1 ? strtoul(argv[1], nullptr, 10) : std::thread::hardware_concurrency();
+
+    for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+        Report("plain/private", threads, RunThreads(threads, [&](size_t) {
+                   auto local = MakeShared<Plain>();
+                   CopyLoop(local);
+               }),
+               kIterations * threads);
+
+        Report("esft/private", threads, RunThreads(threads, [&](size_t) {
+                   auto local = MakeShared<Connection>();
+                   CopyLoop(local);
+               }),
+               kIterations * threads);
+
+        Report("shared-from-this/private", threads, RunThreads(threads, [&](size_t) {
+                   auto local = MakeShared<Connection>();
+                   SharedFromThisLoop(*local);
+               }),
+               kIterations * threads);
+
+        auto shared = MakeShared<Connection>();
+        Report("esft/shared", threads, RunThreads(threads, [&](size_t) { CopyLoop(shared); }),
+               kIterations * threads);
+    }
+}
@@ -0,0 +1,100 @@
+// Observer fan-out: an event locks every registered WeakPtr, notifies the live observers and drops
+// the locks again. Observers are allocated in random order and a tenth of them are gone, so the
+// control blocks are scattered the way a long-running process leaves them.
+//
+//   expired+promote  Expired() and then SharedPtr(const WeakPtr&), what Lock() used to do
+//   lock             WeakPtr::Lock() on each observer in turn
+//   lock_all         LockAll() into a buffer kept from event to event, then notify
+//   std::weak_ptr    std::weak_ptr::lock() on each observer in turn
+//
+// Usage: fanout [observers] [events]
+
+#include "bench.h"
+
+#include "../shared.h"
+#include "../weak.h"
+
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <stdlib.h>
+
+struct Observer {
+    void Notify(long event) {
+        seen += event;
+    }
+    long seen = 0;
+};
+
+double Since(BenchClock::time_point start) {
+    return std::chrono::duration<double, std::nano>(BenchClock::now() - start).count();
+}
+
+template <typename Shared, typename Weak, typename Make>
+void Register(size_t observers, std::vector<Shared>& alive, std::vector<Weak>& weak, Make make) {
+    std::vector<Shared> all;
+    for (size_t i = 0; i < observers; ++i) {
+        all.push_back(make());
+    }
+    std::shuffle(all.begin(), all.end(), std::mt19937(42));
+    for (size_t i = 0; i < observers; ++i) {
+        weak.emplace_back(all[i]);
+        if (i % 10 != 0) {
+            alive.push_back(all[i]);
+        }
+    }
+    // Neighbours in `weak` should not be neighbours in memory
+    std::shuffle(weak.begin(), weak.end(), std::mt19937(7));
+}
+
+template <typename Event>
+void Run(const char* name, size_t observers, size_t events, Event event) {
+    auto start = BenchClock::now();
+    for (size_t i = 0; i < events; ++i) {
+        event(static_cast<long>(i));
+    }
+    Report(name, 1, Since(start), observers * events);
+}
+
+int main(int argc, char** argv) {
+    size_t observers = argc > 1 ? strtoul(argv[1], nullptr, 10) : 10'000;
+    size_t events = argc > 2 ? strtoul(argv[2], nullptr, 10) : 2'000;
+
+    std::vector<SharedPtr<Observer>> alive;
+    std::vector<WeakPtr<Observer>> weak;
+    Register(observers, alive, weak, [] { return MakeShared<Observer>(); });
+
+    Run("expired+promote", observers, events, [&](long event) {
+        for (const auto& observer : weak) {
+            if (!observer.Expired()) {
+                SharedPtr<Observer>(observer)->Notify(event);
+            }
+        }
+    });
+    Run("lock", observers, events, [&](long event) {
+        for (const auto& observer : weak) {
+            if (auto locked = observer.Lock()) {
+                locked->Notify(event);
+            }
+        }
+    });
+    std::vector<SharedPtr<Observer>> buffer;
+    Run("lock_all", observers, events, [&](long event) {
+        LockAll(weak.data(), weak.size(), buffer);
+        for (const auto& locked : buffer) {
+            locked->Notify(event);
+        }
+        buffer.clear();
+    });
+
+    std::vector<std::shared_ptr<Observer>> std_alive;
+    std::vector<std::weak_ptr<Observer>> std_weak;
+    Register(observers, std_alive, std_weak, [] { return std::make_shared<Observer>(); });
+    Run("std::weak_ptr", observers, events, [&](long event) {
+        for (const auto& observer : std_weak) {
+            if (auto locked = observer.lock()) {
+                locked->Notify(event);
+            }
+        }
+    });
+}
@@ -0,0 +1,64 @@
+// Copy/destroy throughput of IntrusivePtr under the two counter policies, and for a
+// WeakRefCounted object that nobody observes.
+//
+// As in counting.cpp, "shared" hammers one object from every thread (only legal with
+// ThreadSafeCounter / WeakRefCounted), while "private" gives each thread its own object.
+//
+// Usage: intrusive [max_threads]
+
+#include "bench.h"
+
+#include "../intrusive.h"
+
+#include <stdlib.h>
+
+constexpr size_t kIterations = 5'000'000;
+
+struct SafeObject : ThreadSafeRefCounted<SafeObject> {
+    int value = 42;
+};
+
+struct SimpleObject : SimpleRefCounted<SimpleObject> {
+    int value = 42;
+};
+
+struct WeakCapableObject : WeakRefCounted<WeakCapableObject> {
+    int value = 42;
+};
+
+template <typename T>
+void CopyLoop(const IntrusivePtr<T>& source) {
+    for (size_t i = 0; i < kIterations; ++i) {
+        IntrusivePtr<T> copy(source);
+        DoNotOptimize(copy.Get());
+    }
+}
+
+int main(int argc, char** argv) {
+    size_t max_threads =
+        argc > 1 ? strtoul(argv[1], nullptr, 10) : std::thread::hardware_concurrency();
+
+    for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+        auto shared = MakeIntrusive<SafeObject>();
+        Report("thread-safe/shared", threads,
+               RunThreads(threads, [&](size_t) { CopyLoop(shared); }), kIterations * threads);
+
+        Report("thread-safe/private", threads, RunThreads(threads, [&](size_t) {
+                   auto local = MakeIntrusive<SafeObject>();
+                   CopyLoop(local);
+               }),
+               kIterations * threads);
+
+        Report("simple/private", threads, RunThreads(threads, [&](size_t) {
+                   auto local = MakeIntrusive<SimpleObject>();
+                   CopyLoop(local);
+               }),
+               kIterations * threads);
+
+        Report("weak-capable/private", threads, RunThreads(threads, [&](size_t) {
+                   auto local = MakeIntrusive<WeakCapableObject>();
+                   CopyLoop(local);
+               }),
+               kIterations * threads);
+    }
+}
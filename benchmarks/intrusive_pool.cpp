@@ -0,0 +1,121 @@
+// Short-lived IntrusivePtr messages: MakeIntrusive + DefaultDelete (heap) against
+// MakeIntrusivePooled + PooledDelete (ObjectPool).
+//
+// "churn" keeps a window of live messages on one thread and replaces one per step.
+// "handoff" allocates on a producer thread and drops the messages on a consumer thread, which is
+// where the pool has to return slots across threads.
+// Reported: allocations per second from an untimed run, and the p99 latency of a single create
+// from a second run that reads the clock around every create (so it includes the clock's cost).
+//
+// Usage: intrusive_pool [messages]
+
+#include "bench.h"
+
+#include "../intrusive.h"
+
+#include <algorithm>
+#include <mutex>
+#include <stdlib.h>
+
+constexpr size_t kWindow = 4096;
+
+template <typename Deleter>
+struct Message : ThreadSafeRefCounted<Message<Deleter>, Deleter> {
+    explicit Message(size_t id) : id(id){};
+    size_t id;
+    char payload[48];
+};
+
+using HeapMessage = Message<DefaultDelete<>>;
+using PooledMessage = Message<PooledDelete>;
+
+template <typename T>
+IntrusivePtr<T> Create(size_t id) {
+    if constexpr (std::is_same_v<T, PooledMessage>) {
+        return MakeIntrusivePooled<T>(id);
+    } else {
+        return MakeIntrusive<T>(id);
+    }
+}
+
+// Creates one message, recording how long it took if `latencies` is given.
+template <typename T>
+IntrusivePtr<T> TimedCreate(size_t id, std::vector<uint32_t>* latencies) {
+    if (latencies == nullptr) {
+        return Create<T>(id);
+    }
+    auto start = BenchClock::now();
+    auto message = Create<T>(id);
+    latencies->push_back(
+        std::chrono::duration<double, std::nano>(BenchClock::now() - start).count());
+    return message;
+}
+
+// Runs `scenario` once for throughput and once for latencies.
+using Scenario = double (*)(size_t messages, std::vector<uint32_t>* latencies);
+
+void Measure(const char* name, size_t messages, Scenario scenario) {
+    double ns = scenario(messages, nullptr);
+
+    std::vector<uint32_t> latencies;
+    latencies.reserve(messages);
+    scenario(messages, &latencies);
+    size_t p99 = latencies.size() * 99 / 100;
+    std::nth_element(latencies.begin(), latencies.begin() + p99, latencies.end());
+
+    printf("%-24s %12.0f allocs/s   p99 %5u ns\n", name, messages / (ns / 1e9), latencies[p99]);
+}
+
+template <typename T>
+double Churn(size_t messages, std::vector<uint32_t>* latencies) {
+    std::vector<IntrusivePtr<T>> window(kWindow);
+
+    auto start = BenchClock::now();
+    for (size_t i = 0; i < messages; ++i) {
+        window[i % kWindow] = TimedCreate<T>(i, latencies);
+    }
+    return std::chrono::duration<double, std::nano>(BenchClock::now() - start).count();
+}
+
+template <typename T>
+double Handoff(size_t messages, std::vector<uint32_t>* latencies) {
+    std::mutex mutex;
+    std::vector<IntrusivePtr<T>> queue;
+
+    return RunThreads(2, [&](size_t index) {
+        if (index == 0) {
+            std::vector<IntrusivePtr<T>> batch;
+            for (size_t i = 0; i < messages; ++i) {
+                batch.push_back(TimedCreate<T>(i, latencies));
+                if (batch.size() == 64) {
+                    std::lock_guard guard(mutex);
+                    std::move(batch.begin(), batch.end(), std::back_inserter(queue));
+                    batch.clear();
+                }
+            }
+            std::lock_guard guard(mutex);
+            std::move(batch.begin(), batch.end(), std::back_inserter(queue));
+            return;
+        }
+
+        size_t received = 0;
+        std::vector<IntrusivePtr<T>> taken;
+        while (received < messages) {
+            {
+                std::lock_guard guard(mutex);
+                taken.swap(queue);
+            }
+            received += taken.size();
+            taken.clear();
+        }
+    });
+}
+
+int main(int argc, char** argv) {
+    size_t messages = argc > 1 ? strtoul(argv[1], nullptr, 10) : 5'000'000;
+
+    Measure("churn/heap", messages, &Churn<HeapMessage>);
+    Measure("churn/pooled", messages, &Churn<PooledMessage>);
+    Measure("handoff/heap", messages, &Handoff<HeapMessage>);
+    Measure("handoff/pooled", messages, &Handoff<PooledMessage>);
+}
@@ -0,0 +1,101 @@
+// IntrusivePtr messages passed through an MPSC queue that, like a C callback layer, only carries
+// raw pointers.
+//
+// "inc/dec" is what crossing such a boundary costs without adopt/detach: the producer takes an
+// extra reference for the queue and drops its own, the consumer wraps the pointer (IncRef) and
+// then gives the queue's reference back (DecRef). "adopt/detach" hands the single reference
+// through: Detach() on the way in, IntrusivePtr(ptr, kAdoptRef) on the way out.
+//
+// Usage: intrusive_queue [producers]
+
+#include "bench.h"
+
+#include "../intrusive.h"
+
+#include <stdlib.h>
+
+constexpr size_t kMessagesPerProducer = 1'000'000;
+
+struct Message : ThreadSafeRefCounted<Message> {
+    explicit Message(size_t payload) : payload(payload){};
+    size_t payload;
+    Message* next = nullptr;
+};
+
+// Producers push onto a lock-free stack, the consumer takes it over in one exchange and reverses
+// it, so messages of one producer come out in order.
+class MpscQueue {
+public:
+    void Push(void* raw) {
+        auto* message = static_cast<Message*>(raw);
+        message->next = head_.load(std::memory_order_relaxed);
+        while (!head_.compare_exchange_weak(message->next, message, std::memory_order_release,
+                                            std::memory_order_relaxed)) {
+        }
+    }
+
+    // Returns the taken messages oldest first, linked through `next`.
+    Message* PopAll() {
+        Message* message = head_.exchange(nullptr, std::memory_order_acquire);
+        Message* reversed = nullptr;
+        while (message) {
+            Message* next = message->next;
+            message->next = reversed;
+            reversed = message;
+            message = next;
+        }
+        return reversed;
+    }
+
+private:
+    std::atomic<Message*> head_{nullptr};
+};
+
+template <bool kAdopt>
+double Run(size_t producers) {
+    MpscQueue queue;
+    size_t total = producers * kMessagesPerProducer;
+
+    return RunThreads(producers + 1, [&](size_t index) {
+        if (index < producers) {
+            for (size_t i = 0; i < kMessagesPerProducer; ++i) {
+                auto message = MakeIntrusive<Message>(i);
+                if constexpr (kAdopt) {
+                    queue.Push(message.Detach());
+                } else {
+                    message->IncRef();
+                    queue.Push(message.Get());
+                }
+            }
+            return;
+        }
+
+        size_t received = 0;
+        size_t sum = 0;
+        while (received < total) {
+            Message* raw = queue.PopAll();
+            while (raw) {
+                Message* next = raw->next;
+                if constexpr (kAdopt) {
+                    IntrusivePtr<Message> message(raw, kAdoptRef);
+                    sum += message->payload;
+                } else {
+                    IntrusivePtr<Message> message(raw);
+                    raw->DecRef();
+                    sum += message->payload;
+                }
+                raw = next;
+                ++received;
+            }
+        }
+        DoNotOptimize(sum);
+    });
+}
+
+int main(int argc, char** argv) {
+    size_t producers = argc > 1 ? strtoul(argv[1], nullptr, 10) : 3;
+    size_t total = producers * kMessagesPerProducer;
+
+    Report("inc/dec", producers + 1, Run<false>(producers), total);
+    Report("adopt/detach", producers + 1, Run<true>(producers), total);
+}
@@ -0,0 +1,50 @@
+// push_back of copies of one SharedPtr into a growing container.
+//
+// "std::vector/copying growth" wraps the pointer in a type whose move may throw, which is what
+// std::vector<SharedPtr> saw before the moves were noexcept: every reallocation copies the
+// elements (one atomic increment each) and destroys the old ones (one atomic decrement each).
+// "std::vector" now moves them, and RelocatingVector copies the bytes with realloc / mremap.
+//
+// Usage: relocation [elements]
+
+#include "bench.h"
+
+#include "../relocating_vector.h"
+#include "../shared.h"
+
+#include <stdlib.h>
+
+struct CopyingGrowth {
+    explicit CopyingGrowth(const SharedPtr<int>& ptr) : ptr(ptr){};
+    CopyingGrowth(const CopyingGrowth&) = default;
+    CopyingGrowth(CopyingGrowth&& other) noexcept(false) : ptr(std::move(other.ptr)){};
+
+    SharedPtr<int> ptr;
+};
+
+template <typename Container, typename Push>
+void Run(const char* name, size_t elements, Push push) {
+    auto source = MakeShared<int>(42);
+    Container container;
+
+    auto start = BenchClock::now();
+    for (size_t i = 0; i < elements; ++i) {
+        push(container, source);
+    }
+    double ns = std::chrono::duration<double, std::nano>(BenchClock::now() - start).count();
+    Report(name, 1, ns, elements);
+}
+
+int main(int argc, char** argv) {
+    size_t elements = argc > 1 ? strtoul(argv[1], nullptr, 10) : 100'000'000;
+
+    Run<std::vector<CopyingGrowth>>(
+        "std::vector/copying growth", elements,
+        [](auto& container, const auto& source) { container.emplace_back(source); });
+    Run<std::vector<SharedPtr<int>>>(
+        "std::vector", elements,
+        [](auto& container, const auto& source) { container.push_back(source); });
+    Run<RelocatingVector<SharedPtr<int>>>(
+        "RelocatingVector", elements,
+        [](auto& container, const auto& source) { container.PushBack(source); });
+}
@@ -0,0 +1,53 @@
+// Sharded against atomic and biased counting for one object every thread keeps copying, such as
+// a global schema: each thread copies and drops the same SharedPtr, at 1, 2, 4 ... max_threads.
+// "lock" promotes a WeakPtr instead, which always goes through the sharded block's central word.
+//
+// Usage: sharded [max_threads] [iterations_per_thread]
+
+#include "bench.h"
+
+#include "../shared.h"
+#include "../weak.h"
+
+#include <stdlib.h>
+
+struct Schema {
+    int version = 1;
+};
+
+void CopyLoop(const SharedPtr<Schema>& source, size_t iterations) {
+    for (size_t i = 0; i < iterations; ++i) {
+        SharedPtr<Schema> copy(source);
+        DoNotOptimize(copy.Get());
+    }
+}
+
+void LockLoop(const WeakPtr<Schema>& source, size_t iterations) {
+    for (size_t i = 0; i < iterations; ++i) {
+        SharedPtr<Schema> locked = source.Lock();
+        DoNotOptimize(locked.Get());
+    }
+}
+
+template <CountPolicy Policy>
+void Run(const char* copy_name, const char* lock_name, size_t max_threads, size_t iterations) {
+    auto schema = MakeShared<Schema, Policy>();
+    WeakPtr<Schema> weak(schema);
+    for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+        double ns = RunThreads(threads, [&](size_t) { CopyLoop(schema, iterations); });
+        Report(copy_name, threads, ns, iterations * threads);
+    }
+    for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+        double ns = RunThreads(threads, [&](size_t) { LockLoop(weak, iterations); });
+        Report(lock_name, threads, ns, iterations * threads);
+    }
+}
+
+int main(int argc, char** argv) {
+    size_t max_threads = argc > 1 ? strtoul(argv[1], nullptr, 10) : 64;
+    size_t iterations = argc > 2 ? strtoul(argv[2], nullptr, 10) : 2'000'000;
+
+    Run<CountPolicy::kAtomic>("atomic/copy", "atomic/lock", max_threads, iterations);
+    Run<CountPolicy::kBiased>("biased/copy", "biased/lock", max_threads, iterations);
+    Run<CountPolicy::kSharded>("sharded/copy", "sharded/lock", max_threads, iterations);
+}
@@ -0,0 +1,122 @@
+// Parse-split-forward over 64 KiB packets of length-prefixed messages (200..1400 bytes: a 4-byte
+// length, a 16-byte header, the body). Each message is cut out of its packet, split into header
+// and body, the header is rewritten (a hop count) and header + body are gathered for output.
+//
+//   shared_buffer   SharedBuffer slices, the header through copy-on-write, SharedBufferChain
+//                   iovecs for the output
+//   memcpy          std::vector<char> at every stage, the way copying stages do it, and one
+//                   contiguous output buffer per message
+//
+// Usage: shared_buffer [packets]
+
+#include "bench.h"
+
+#include "../shared_buffer.h"
+
+#include <cstring>
+#include <random>
+#include <stdlib.h>
+#include <vector>
+
+constexpr size_t kPacketSize = 64 << 10;
+constexpr size_t kLengthSize = 4;
+constexpr size_t kHeaderSize = 16;
+
+std::vector<char> MakePacket(std::mt19937& random, size_t* messages) {
+    std::uniform_int_distribution<uint32_t> length(200, 1400);
+    std::vector<char> packet;
+    while (true) {
+        uint32_t size = length(random);
+        if (packet.size() + kLengthSize + size > kPacketSize) {
+            return packet;
+        }
+        size_t at = packet.size();
+        packet.resize(at + kLengthSize + size, 'x');
+        std::memcpy(packet.data() + at, &size, kLengthSize);
+        ++*messages;
+    }
+}
+
+uint32_t LengthAt(const void* data) {
+    uint32_t length;
+    std::memcpy(&length, data, kLengthSize);
+    return length;
+}
+
+size_t ForwardShared(const std::vector<char>& bytes) {
+    SharedBuffer packet(bytes.data(), bytes.size());
+    size_t forwarded = 0;
+    SharedBufferChain out;  // reused, as a connection's output queue would be
+    iovec iovecs[2];
+    while (!packet.Empty()) {
+        // parse
+        SharedBuffer message = packet.TakePrefix(kLengthSize + LengthAt(packet.Data()));
+        message.RemovePrefix(kLengthSize);
+        // split
+        SharedBuffer header = message.Slice(0, kHeaderSize);
+        SharedBuffer body = message.Slice(kHeaderSize);
+        message = SharedBuffer();
+        // forward
+        std::byte& hops = header.MutableData()[0];
+        hops = std::byte(std::to_integer<int>(hops) + 1);
+        out.Append(std::move(header));
+        out.Append(std::move(body));
+        size_t count = out.FillIovecs(iovecs, 2);
+        for (size_t i = 0; i < count; ++i) {
+            forwarded += iovecs[i].iov_len;
+        }
+        DoNotOptimize(iovecs);
+        out.Clear();
+    }
+    return forwarded;
+}
+
+size_t ForwardCopied(const std::vector<char>& bytes) {
+    std::vector<char> packet(bytes);
+    size_t forwarded = 0;
+    size_t at = 0;
+    while (at < packet.size()) {
+        // parse
+        uint32_t length = LengthAt(packet.data() + at);
+        std::vector<char> message(packet.begin() + at + kLengthSize,
+                                  packet.begin() + at + kLengthSize + length);
+        at += kLengthSize + length;
+        // split
+        std::vector<char> header(message.begin(), message.begin() + kHeaderSize);
+        std::vector<char> body(message.begin() + kHeaderSize, message.end());
+        // forward
+        ++header[0];
+        std::vector<char> out(header);
+        out.insert(out.end(), body.begin(), body.end());
+        forwarded += out.size();
+        DoNotOptimize(out.data());
+    }
+    return forwarded;
+}
+
+template <typename Forward>
+void Run(const char* name, const std::vector<std::vector<char>>& packets, size_t messages,
+         Forward forward) {
+    size_t forwarded = 0;
+    auto start = BenchClock::now();
+    for (const auto& packet : packets) {
+        forwarded += forward(packet);
+    }
+    double ns = std::chrono::duration<double, std::nano>(BenchClock::now() - start).count();
+    Report(name, 1, ns, messages);
+    printf("%-40s %.2f GB/s forwarded\n", name, forwarded / ns);
+}
+
+int main(int argc, char** argv) {
+    size_t count = argc > 1 ? strtoul(argv[1], nullptr, 10) : 2'000;
+
+    std::mt19937 random(42);
+    size_t messages = 0;
+    std::vector<std::vector<char>> packets;
+    for (size_t i = 0; i < count; ++i) {
+        packets.push_back(MakePacket(random, &messages));
+    }
+
+    Run("shared_buffer", packets, messages, ForwardShared);
+    Run("memcpy", packets, messages, ForwardCopied);
+}
@@ -0,0 +1,102 @@
+// Interning under a skewed key stream: every thread asks for keys (small-key heavy, out of 20k)
+// and keeps only its last 1024 values, so unpopular objects die and are asked for again later.
+//
+//   cache         WeakValueCache, sharded, entries erased by their object's destruction
+//   mutex+map     the hand-written version: one mutex over unordered_map<key, WeakPtr>, expired
+//                 entries overwritten when their key comes back and never erased otherwise
+//
+// Prints throughput per thread count, then the hit rate and the entries left in the map.
+//
+// Usage: weak_value_cache [max_threads] [lookups_per_thread]
+
+#include "bench.h"
+
+#include "../weak_value_cache.h"
+
+#include <mutex>
+#include <random>
+#include <stdlib.h>
+#include <string>
+#include <unordered_map>
+
+constexpr uint64_t kKeys = 20'000;
+constexpr size_t kHeld = 1024;
+
+struct Interned {
+    explicit Interned(uint64_t key) : text(std::to_string(key) + "/interned") {
+    }
+    std::string text;
+};
+
+class MutexMap {
+public:
+    SharedPtr<Interned> GetOrCreate(uint64_t key) {
+        std::lock_guard guard(mutex_);
+        WeakPtr<Interned>& entry = entries_[key];
+        if (auto locked = entry.Lock()) {
+            ++hits_;
+            return locked;
+        }
+        auto created = MakeShared<Interned>(key);
+        entry = created;
+        ++misses_;
+        return created;
+    }
+    size_t Hits() const {
+        return hits_;
+    }
+    size_t Misses() const {
+        return misses_;
+    }
+    size_t Size() const {
+        return entries_.size();
+    }
+
+private:
+    std::mutex mutex_;
+    std::unordered_map<uint64_t, WeakPtr<Interned>> entries_;
+    size_t hits_ = 0;
+    size_t misses_ = 0;
+};
+
+// Cubing a uniform draw leans the stream towards small keys
+template <typename Get>
+void Lookups(size_t thread, size_t lookups, Get get) {
+    std::mt19937_64 random(thread + 1);
+    std::uniform_real_distribution<double> uniform(0, 1);
+    std::vector<SharedPtr<Interned>> held(kHeld);
+    for (size_t i = 0; i < lookups; ++i) {
+        double u = uniform(random);
+        held[i % kHeld] = get(static_cast<uint64_t>(u * u * u * kKeys));
+        DoNotOptimize(held[i % kHeld].Get());
+    }
+}
+
+void PrintHitRate(const char* name, size_t hits, size_t misses, size_t entries) {
+    printf("%-40s hit rate %5.1f%%, %zu entries left\n", name, 100.0 * hits / (hits + misses),
+           entries);
+}
+
+int main(int argc, char** argv) {
+    size_t max_threads = argc > 1 ? strtoul(argv[1], nullptr, 10) : 16;
+    size_t lookups = argc > 2 ? strtoul(argv[2], nullptr, 10) : 500'000;
+
+    for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+        WeakValueCache<uint64_t, Interned> cache;
+        double ns = RunThreads(threads, [&](size_t thread) {
+            Lookups(thread, lookups, [&](uint64_t key) {
+                return cache.GetOrCreate(key, [&] { return Interned(key); });
+            });
+        });
+        Report("cache", threads, ns, lookups * threads);
+        auto stats = cache.Stats();
+        PrintHitRate("cache", stats.hits, stats.misses, cache.Size());
+
+        MutexMap map;
+        ns = RunThreads(threads, [&](size_t thread) {
+            Lookups(thread, lookups, [&](uint64_t key) { return map.GetOrCreate(key); });
+        });
+        Report("mutex+map", threads, ns, lookups * threads);
+        PrintHitRate("mutex+map", map.Hits(), map.Misses(), map.Size());
+    }
+}
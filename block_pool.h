@@ -0,0 +1,171 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <stdlib.h>
+#include <vector>
+
+// Per-thread size-class pool for control blocks.
+//
+// Small blocks are carved out of 64 KiB slabs, each slab serving one size class of one pool.
+// The slab header sits at the slab's aligned start, so a freed slot finds its pool with a mask.
+// A slot freed by the owning thread goes to a plain free list. A slot freed by any other thread
+// is pushed onto the owner's lock-free "remote" list, which the owner takes over in one exchange
+// once its local list runs dry. Pools of finished threads are parked and handed to the next
+// thread that needs one, so their slabs are reused rather than leaked. A block allocated after the
+// thread's pool was parked (from another thread_local's destructor) comes from one shared pool,
+// under a lock.
+class ControlBlockPool {
+public:
+    static constexpr size_t kGranularity = 16;
+    static constexpr size_t kMaxSize = 256;
+    static constexpr size_t kClasses = kMaxSize / kGranularity;
+    static constexpr size_t kSlabSize = size_t(1) << 16;
+    static constexpr size_t kChunkSize = size_t(1) << 21;
+
+    static void* Allocate(size_t size) {
+        if (size > kMaxSize) {
+            return ::operator new(size);
+        }
+        if (exited_) {
+            return AllocateShared(ClassOf(size));
+        }
+        return Current()->AllocateSlot(ClassOf(size));
+    }
+
+    static void Free(void* ptr, size_t size) {
+        if (size > kMaxSize) {
+            ::operator delete(ptr);
+            return;
+        }
+
+        auto* slot = static_cast<FreeSlot*>(ptr);
+        SlabHeader* slab = SlabOf(ptr);
+        if (slab->owner == current_) {
+            slot->next = current_->local_[slab->size_class];
+            current_->local_[slab->size_class] = slot;
+        } else {
+            slab->owner->PushRemote(slab->size_class, slot);
+        }
+    }
+
+private:
+    struct FreeSlot {
+        FreeSlot* next;
+    };
+
+    struct alignas(kGranularity) SlabHeader {
+        ControlBlockPool* owner;
+        size_t size_class;
+    };
+
+    struct ThreadExit {
+        ~ThreadExit() {
+            std::lock_guard guard(ParkedMutex());
+            Parked().push_back(current_);
+            current_ = nullptr;
+            exited_ = true;
+        }
+    };
+
+    static ControlBlockPool* Current() {
+        if (current_ == nullptr) {
+            static thread_local ThreadExit exit_guard;
+            std::lock_guard guard(ParkedMutex());
+            if (Parked().empty()) {
+                current_ = new ControlBlockPool();
+            } else {
+                current_ = Parked().back();
+                Parked().pop_back();
+            }
+        }
+        return current_;
+    }
+
+    static std::mutex& ParkedMutex() {
+        static std::mutex mutex;
+        return mutex;
+    }
+
+    // Never destroyed: blocks may still be freed into parked pools during static destruction.
+    static std::vector<ControlBlockPool*>& Parked() {
+        static auto* pools = new std::vector<ControlBlockPool*>();
+        return *pools;
+    }
+
+    // Parking is over for this thread, a new pool of its own would never be parked again. The
+    // shared pool belongs to no thread, so every slot comes back to it through the remote lists.
+    static void* AllocateShared(size_t size_class) {
+        static auto* shared = new ControlBlockPool();  // never destroyed, like the parked pools
+        static std::mutex mutex;
+        std::lock_guard guard(mutex);
+        return shared->AllocateSlot(size_class);
+    }
+
+    static size_t ClassOf(size_t size) {
+        return size == 0 ? 0 : (size - 1) / kGranularity;
+    }
+
+    static SlabHeader* SlabOf(void* ptr) {
+        return reinterpret_cast<SlabHeader*>(reinterpret_cast<uintptr_t>(ptr) & ~(kSlabSize - 1));
+    }
+
+    void* AllocateSlot(size_t size_class) {
+        FreeSlot* slot = local_[size_class];
+        if (slot == nullptr) {
+            slot = remote_[size_class].exchange(nullptr, std::memory_order_acquire);
+        }
+        if (slot) {
+            local_[size_class] = slot->next;
+            return slot;
+        }
+
+        size_t slot_size = (size_class + 1) * kGranularity;
+        if (static_cast<size_t>(bump_end_[size_class] - bump_[size_class]) < slot_size) {
+            char* slab = NewSlab();
+            new (slab) SlabHeader{this, size_class};
+            bump_[size_class] = slab + sizeof(SlabHeader);
+            bump_end_[size_class] = slab + kSlabSize;
+        }
+
+        void* result = bump_[size_class];
+        bump_[size_class] += slot_size;
+        return result;
+    }
+
+    // Slabs are cut from 2 MiB chunks: one 64 KiB aligned_alloc per slab would mostly end up
+    // as a separate mapping, which costs TLB reach (and huge pages) on large heaps.
+    char* NewSlab() {
+        if (chunk_ == chunk_end_) {
+            chunk_ = static_cast<char*>(aligned_alloc(kSlabSize, kChunkSize));
+            if (chunk_ == nullptr) {
+                throw std::bad_alloc();
+            }
+            chunk_end_ = chunk_ + kChunkSize;
+        }
+        char* slab = chunk_;
+        chunk_ += kSlabSize;
+        return slab;
+    }
+
+    void PushRemote(size_t size_class, FreeSlot* slot) {
+        slot->next = remote_[size_class].load(std::memory_order_relaxed);
+        while (!remote_[size_class].compare_exchange_weak(slot->next, slot,
+                                                          std::memory_order_release,
+                                                          std::memory_order_relaxed)) {
+        }
+    }
+
+    FreeSlot* local_[kClasses] = {};
+    char* bump_[kClasses] = {};
+    char* bump_end_[kClasses] = {};
+    std::atomic<FreeSlot*> remote_[kClasses] = {};
+    char* chunk_ = nullptr;
+    char* chunk_end_ = nullptr;
+
+    static inline thread_local ControlBlockPool* current_ = nullptr;
+    static inline thread_local bool exited_ = false;
+};
@@ -0,0 +1,197 @@
+#pragma once
+
+#include "shared.h"
+#include "weak.h"
+
+#include <cstddef>  // std::nullptr_t
+#include <utility>
+
+class BadCompactPtr : public std::exception {};
+
+// One-word SharedPtr for objects made by MakeShared / AllocateShared / MakeCompactShared.
+//
+// Only the control block pointer is stored. The object sits at a fixed offset in such a block
+// (ControlBlockEmplace::kStorageOffset), which depends on the block's counting policy alone, so
+// Get() is computed from the block. Anything else, i.e. a SharedPtr owning a `new`-ed object or
+// pointing into its object through the aliasing constructor, has no such offset: converting one
+// throws BadCompactPtr, and the aliasing constructor does not exist.
+template <typename T>
+class CompactSharedPtr {
+    static_assert(!std::is_array_v<T>, "CompactSharedPtr holds a single object");
+
+    using PlainBlock = ControlBlockEmplace<T, ControlBlockBase>;
+    using BiasedBlock = ControlBlockEmplace<T, BiasedControlBlockBase>;
+    using ShardedBlock = ControlBlockEmplace<T, ShardedControlBlockBase>;
+
+public:
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    CompactSharedPtr(){};
+    CompactSharedPtr(std::nullptr_t){};
+    // Adopts a strong reference to a MakeShared-style block
+    explicit CompactSharedPtr(ControlBlockBase* block) : block_(block){};
+
+    explicit CompactSharedPtr(const SharedPtr<T>& other) : block_(CheckedBlock(other)) {
+        if (block_) {
+            block_->IncStrong();
+        }
+    };
+    explicit CompactSharedPtr(SharedPtr<T>&& other) : block_(CheckedBlock(other)) {
+        other.CreateNullObject();
+    };
+    // Promote `WeakPtr`, throws BadWeakPtr if the object is gone
+    explicit CompactSharedPtr(const WeakPtr<T>& other)
+        : CompactSharedPtr(SharedPtr<T>(other)){};
+
+    // The object pointer is never stored, so there is nothing to alias
+    template <typename Y>
+    CompactSharedPtr(const SharedPtr<Y>& other, T* ptr) = delete;
+
+    CompactSharedPtr(const CompactSharedPtr& other) : block_(other.block_) {
+        if (block_) {
+            block_->IncStrong();
+        }
+    };
+    CompactSharedPtr(CompactSharedPtr&& other) noexcept : block_(other.block_) {
+        other.block_ = nullptr;
+    };
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // `operator=`-s
+
+    CompactSharedPtr& operator=(const CompactSharedPtr& other) {
+        if (&other == this) {
+            return *this;
+        }
+
+        DeleteBlock();
+        block_ = other.block_;
+        if (block_) {
+            block_->IncStrong();
+        }
+
+        return *this;
+    };
+    CompactSharedPtr& operator=(CompactSharedPtr&& other) noexcept {
+        if (&other == this) {
+            return *this;
+        }
+
+        DeleteBlock();
+        std::swap(block_, other.block_);
+
+        return *this;
+    };
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Destructor
+
+    ~CompactSharedPtr() {
+        DeleteBlock();
+    };
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Conversions
+
+    operator SharedPtr<T>() const& {
+        if (block_ == nullptr) {
+            return SharedPtr<T>();
+        }
+        block_->IncStrong();
+        return SharedPtr<T>(block_, Get());
+    };
+    operator SharedPtr<T>() && {
+        if (block_ == nullptr) {
+            return SharedPtr<T>();
+        }
+        T* ptr = Get();
+        return SharedPtr<T>(std::exchange(block_, nullptr), ptr);
+    };
+    operator WeakPtr<T>() const {
+        return WeakPtr<T>(SharedPtr<T>(*this));
+    };
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Modifiers
+
+    void Reset() {
+        DeleteBlock();
+    };
+    void Swap(CompactSharedPtr& other) {
+        std::swap(block_, other.block_);
+    };
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    ControlBlockBase* GetBlock() const {
+        return block_;
+    }
+
+    T* Get() const {
+        if (block_ == nullptr) {
+            return nullptr;
+        }
+        return ObjectOf(block_);
+    };
+    T& operator*() const {
+        return *ObjectOf(block_);
+    };
+    T* operator->() const {
+        return ObjectOf(block_);
+    };
+    size_t UseCount() const {
+        if (block_) {
+            return block_->StrongCount();
+        } else {
+            return 0;
+        }
+    };
+    explicit operator bool() const {
+        return block_ != nullptr;
+    };
+
+private:
+    ControlBlockBase* block_ = nullptr;
+
+    static T* ObjectOf(ControlBlockBase* block) {
+        static_assert(kStorageOffsetMatches<PlainBlock> && kStorageOffsetMatches<BiasedBlock> &&
+                      kStorageOffsetMatches<ShardedBlock>);
+        size_t offset = PlainBlock::kStorageOffset;
+        if (block->Policy() == CountPolicy::kBiased) {
+            offset = BiasedBlock::kStorageOffset;
+        } else if (block->Policy() == CountPolicy::kSharded) {
+            offset = ShardedBlock::kStorageOffset;
+        }
+        return reinterpret_cast<T*>(reinterpret_cast<char*>(block) + offset);
+    }
+
+    static ControlBlockBase* CheckedBlock(const SharedPtr<T>& other) {
+        ControlBlockBase* block = other.GetBlock();
+        if (block && ObjectOf(block) != other.Get()) {
+            throw BadCompactPtr();
+        }
+        return block;
+    }
+
+    void DeleteBlock() {
+        if (block_) {
+            block_->ReleaseStrong();
+            block_ = nullptr;
+        }
+    }
+};
+
+template <typename T>
+struct IsTriviallyRelocatable<CompactSharedPtr<T>> : std::true_type {};
+
+template <typename T, CountPolicy Policy = CountPolicy::kAtomic, typename... Args>
+CompactSharedPtr<T> MakeCompactShared(Args&&... args) {
+    return CompactSharedPtr<T>(MakeShared<T, Policy>(std::forward<Args>(args)...));
+};
+
+template <typename T, typename U>
+inline bool operator==(const CompactSharedPtr<T>& left, const CompactSharedPtr<U>& right) {
+    return left.GetBlock() == right.GetBlock();
+};
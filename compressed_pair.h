@@ -22,9 +22,10 @@ struct CompressedPairElement {
 
 template <typename T, std::size_t I>
 struct CompressedPairElement<T, I, true> : public T {
-    explicit CompressedPairElement(){};
+    explicit CompressedPairElement() : T(){};
+    // Empty types still get constructed from the argument: a lambda has no default constructor
     template <typename T2>
-    explicit CompressedPairElement(T2&&){};
+    explicit CompressedPairElement(T2&& el) : T(std::forward<T2>(el)){};
 
     T& GetValue() {
         return *this;
@@ -42,9 +43,9 @@ class CompressedPair : private CompressedPairElement<F, 0>, private CompressedPa
 
 public:
     CompressedPair() : First(), Second(){};
-    template <typename STemp, typename FTemp>
-    CompressedPair(STemp&& first, FTemp&& second)
-        : First(std::forward<F>(first)), Second(std::forward<S>(second)){};
+    template <typename FTemp, typename STemp>
+    CompressedPair(FTemp&& first, STemp&& second)
+        : First(std::forward<FTemp>(first)), Second(std::forward<STemp>(second)){};
 
     F& GetFirst() {
         return First::GetValue();
@@ -0,0 +1,471 @@
+#pragma once
+
+#include "sw_fwd.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>  // std::nullptr_t
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Reclaims reference cycles among objects made by MakeCollectable, by synchronous trial deletion
+// (Bacon & Rajan, "Concurrent Cycle Collection in Reference Counted Systems", ECOOP'01).
+//
+// A type takes part by showing its outgoing pointers to the collector:
+//
+//     void Trace(CycleTracer& tracer) const {
+//         tracer.Visit(session_);
+//         for (const auto& subscription : subscriptions_) tracer.Visit(subscription);
+//     }
+//
+// Whenever a CollectableSharedPtr drops a strong count to a non-zero value, the block may have
+// just become the entry of a garbage cycle, so it is buffered as a candidate root (once, pinned
+// by a weak reference so the block outlives its object). CycleCollector::Collect subtracts the
+// references the subgraph reachable from the candidates holds on itself; blocks left at zero are
+// referenced from inside it only, and are destroyed. Types without Trace cannot close a cycle,
+// they are never buffered.
+//
+// Pointers the tracer is not shown (a CollectableSharedPtr inside a plain SharedPtr, say) count
+// as references from outside, so a missing edge leaks, it never frees too much. Collect must not
+// run while other threads copy or drop pointers into the graph it traces, and destructors of
+// collected objects must not copy the CollectableSharedPtrs they hold.
+
+template <typename T>
+class CollectableSharedPtr;
+
+class CycleCollector;
+class CycleTracer;
+
+// Control block header of collectable objects. Always counts atomically.
+struct CollectableBlockBase : public ControlBlockBase {
+    enum class Color : uint8_t {
+        kBlack,    // in use, or not looked at
+        kGray,     // reachable from the candidates, `trial` is being worked out
+        kWhite,    // nothing from outside the subgraph refers to it
+        kGarbage,  // being destroyed by the collector
+    };
+
+    explicit CollectableBlockBase(const BlockOps* ops) : ControlBlockBase(ops){};
+
+    // ControlBlockBase::ReleaseStrong, plus buffering the block as a candidate root.
+    inline void ReleaseStrong();
+
+    CycleCollector* collector = nullptr;
+    void (*trace)(CollectableBlockBase*, CycleTracer&) = nullptr;  // nullptr: a leaf type
+    int32_t trial = 0;  // strong count minus the references seen from inside, collector only
+    Color color = Color::kBlack;
+    std::atomic<bool> buffered{false};
+};
+
+// Handed to T::Trace, collects the blocks an object points to.
+class CycleTracer {
+public:
+    template <typename T>
+    void Visit(const CollectableSharedPtr<T>& ptr) {
+        if (CollectableBlockBase* block = ptr.GetBlock()) {
+            edges_.push_back(block);
+        }
+    };
+
+private:
+    friend class CycleCollector;
+
+    std::vector<CollectableBlockBase*> edges_;
+};
+
+struct CollectStats {
+    size_t freed = 0;    // objects destroyed
+    size_t pending = 0;  // candidate roots left for the next call
+};
+
+// Candidate root buffer plus the collection itself. Has to outlive the objects made in it.
+class CycleCollector {
+    using Color = CollectableBlockBase::Color;
+
+public:
+    // Roots per step of a time-budgeted Collect.
+    static constexpr size_t kRootBatch = 64;
+
+    CycleCollector() = default;
+
+    CycleCollector(const CycleCollector&) = delete;
+    CycleCollector& operator=(const CycleCollector&) = delete;
+
+    ~CycleCollector() {
+        Collect();
+    };
+
+    // Used by MakeCollectable. Never destroyed, objects may be dropped during static destruction.
+    static CycleCollector& Global() {
+        static auto* collector = new CycleCollector();
+        return *collector;
+    };
+
+    // Every cycle that is garbage by now, in one pause. Returns the number of objects destroyed.
+    size_t Collect() {
+        return Run(SIZE_MAX, std::chrono::nanoseconds::max()).freed;
+    };
+
+    // Incremental: works through kRootBatch roots at a time until `budget` is used up. The clock
+    // is checked between steps only, so a step over a large subgraph overruns it.
+    CollectStats Collect(std::chrono::nanoseconds budget) {
+        return Run(kRootBatch, budget);
+    };
+
+    size_t Candidates() const {
+        std::lock_guard guard(roots_mutex_);
+        return roots_.size();
+    };
+
+private:
+    friend struct CollectableBlockBase;
+
+    // The caller holds a strong reference, so the block is alive to be pinned.
+    void AddCandidate(CollectableBlockBase* block) {
+        block->IncWeak();
+        std::lock_guard guard(roots_mutex_);
+        roots_.push_back(block);
+    }
+
+    CollectStats Run(size_t batch_size, std::chrono::nanoseconds budget) {
+        using Clock = std::chrono::steady_clock;
+        std::lock_guard collecting(collect_mutex_);
+        auto start = Clock::now();
+
+        CollectStats stats;
+        std::vector<CollectableBlockBase*> batch;
+        do {
+            {
+                std::lock_guard guard(roots_mutex_);
+                size_t taken = roots_.size() < batch_size ? roots_.size() : batch_size;
+                batch.assign(roots_.end() - taken, roots_.end());
+                roots_.resize(roots_.size() - taken);
+            }
+            if (batch.empty()) {
+                break;
+            }
+            stats.freed += CollectRoots(batch);
+        } while (Clock::now() - start < budget);
+
+        stats.pending = Candidates();
+        return stats;
+    }
+
+    size_t CollectRoots(const std::vector<CollectableBlockBase*>& roots) {
+        for (CollectableBlockBase* root : roots) {
+            root->buffered.store(false, std::memory_order_relaxed);
+            if (root->StrongCount() > 0) {  // otherwise only the pin is left
+                MarkGray(root);
+            }
+        }
+        for (CollectableBlockBase* root : roots) {
+            Scan(root);
+        }
+        garbage_.clear();
+        for (CollectableBlockBase* root : roots) {
+            CollectWhite(root);
+        }
+
+        // Garbage edges are dropped without destroying their targets (see ReleaseStrong), the
+        // pins keep every block around until all of the garbage is gone.
+        for (CollectableBlockBase* block : garbage_) {
+            block->color = Color::kGarbage;
+            block->IncWeak();
+        }
+        for (CollectableBlockBase* block : garbage_) {
+            block->DestroyObject();
+        }
+        for (CollectableBlockBase* block : garbage_) {
+            block->ReleaseWeak();
+        }
+        for (CollectableBlockBase* root : roots) {
+            root->ReleaseWeak();
+        }
+        return garbage_.size();
+    }
+
+    const std::vector<CollectableBlockBase*>& Children(CollectableBlockBase* block) {
+        tracer_.edges_.clear();
+        if (block->trace) {
+            block->trace(block, tracer_);
+        }
+        return tracer_.edges_;
+    }
+
+    // The traversals keep explicit stacks: a long chain must not overflow the thread's stack.
+
+    // Subtracts every edge inside the subgraph from its target's trial count.
+    void MarkGray(CollectableBlockBase* root) {
+        if (root->color == Color::kGray) {
+            return;
+        }
+        Gray(root);
+        stack_.push_back(root);
+        while (!stack_.empty()) {
+            CollectableBlockBase* block = stack_.back();
+            stack_.pop_back();
+            for (CollectableBlockBase* child : Children(block)) {
+                if (child->color != Color::kGray) {
+                    Gray(child);
+                    stack_.push_back(child);
+                }
+                --child->trial;
+            }
+        }
+    }
+
+    static void Gray(CollectableBlockBase* block) {
+        block->color = Color::kGray;
+        block->trial = static_cast<int32_t>(block->StrongCount());
+    }
+
+    // Referenced from outside means alive, and so is everything it reaches; the rest turns white.
+    void Scan(CollectableBlockBase* root) {
+        stack_.push_back(root);
+        while (!stack_.empty()) {
+            CollectableBlockBase* block = stack_.back();
+            stack_.pop_back();
+            if (block->color != Color::kGray) {
+                continue;
+            }
+            if (block->trial > 0) {
+                ScanBlack(block);
+                continue;
+            }
+            block->color = Color::kWhite;
+            for (CollectableBlockBase* child : Children(block)) {
+                stack_.push_back(child);
+            }
+        }
+    }
+
+    // Gives the edges of a live block back to their targets.
+    void ScanBlack(CollectableBlockBase* live) {
+        live->color = Color::kBlack;
+        black_stack_.push_back(live);
+        while (!black_stack_.empty()) {
+            CollectableBlockBase* block = black_stack_.back();
+            black_stack_.pop_back();
+            for (CollectableBlockBase* child : Children(block)) {
+                ++child->trial;
+                if (child->color != Color::kBlack) {
+                    child->color = Color::kBlack;
+                    black_stack_.push_back(child);
+                }
+            }
+        }
+    }
+
+    void CollectWhite(CollectableBlockBase* root) {
+        stack_.push_back(root);
+        while (!stack_.empty()) {
+            CollectableBlockBase* block = stack_.back();
+            stack_.pop_back();
+            if (block->color != Color::kWhite) {
+                continue;
+            }
+            block->color = Color::kBlack;
+            garbage_.push_back(block);
+            for (CollectableBlockBase* child : Children(block)) {
+                stack_.push_back(child);
+            }
+        }
+    }
+
+    mutable std::mutex roots_mutex_;
+    std::vector<CollectableBlockBase*> roots_;  // each holds a weak reference
+
+    // Collection state, guarded by collect_mutex_
+    std::mutex collect_mutex_;
+    CycleTracer tracer_;
+    std::vector<CollectableBlockBase*> stack_;
+    std::vector<CollectableBlockBase*> black_stack_;
+    std::vector<CollectableBlockBase*> garbage_;
+};
+
+inline void CollectableBlockBase::ReleaseStrong() {
+    if (color == Color::kGarbage) {
+        // An edge between two garbage objects, the collector destroys the target itself.
+        SMART_POINTERS_RECORD(*ops->type_info, kStrongDec);
+        counts.fetch_sub(kStrongOne, std::memory_order_relaxed);
+        return;
+    }
+
+    // A strong count of one is ours alone, dropping it cannot leave a cycle behind.
+    if (trace && !buffered.load(std::memory_order_relaxed) &&
+        counts.load(std::memory_order_relaxed) >= 2 * kStrongOne &&
+        !buffered.exchange(true, std::memory_order_relaxed)) {
+        collector->AddCandidate(this);
+    }
+    ControlBlockBase::ReleaseStrong();
+}
+
+namespace cycle_detail {
+
+template <typename T, typename = void>
+struct HasTrace : std::false_type {};
+
+template <typename T>
+struct HasTrace<
+    T, std::void_t<decltype(std::declval<const T&>().Trace(std::declval<CycleTracer&>()))>>
+    : std::true_type {};
+
+template <typename T>
+using Block = ControlBlockEmplace<T, CollectableBlockBase>;
+
+template <typename T>
+void TraceObject(CollectableBlockBase* block, CycleTracer& tracer) {
+    const T* object = std::launder(static_cast<Block<T>*>(block)->GetPtr());
+    object->Trace(tracer);
+}
+
+}  // namespace cycle_detail
+
+// SharedPtr for objects made by MakeCollectable. No weak pointers and no aliasing: the collector
+// needs every owner of a block to be a CollectableSharedPtr it can see through Trace.
+template <typename T>
+class CollectableSharedPtr {
+public:
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    CollectableSharedPtr(){};
+    CollectableSharedPtr(std::nullptr_t){};
+    // Adopts a strong reference the caller already holds on `block`
+    CollectableSharedPtr(CollectableBlockBase* block, T* ptr) : block_(block), ptr_(ptr){};
+
+    CollectableSharedPtr(const CollectableSharedPtr& other)
+        : block_(other.block_), ptr_(other.ptr_) {
+        if (block_) {
+            block_->IncStrong();
+        }
+    };
+    template <typename Y, typename = std::enable_if_t<std::is_convertible_v<Y*, T*>>>
+    CollectableSharedPtr(const CollectableSharedPtr<Y>& other)
+        : block_(other.GetBlock()), ptr_(other.Get()) {
+        if (block_) {
+            block_->IncStrong();
+        }
+    };
+    CollectableSharedPtr(CollectableSharedPtr&& other) noexcept
+        : block_(std::exchange(other.block_, nullptr)), ptr_(std::exchange(other.ptr_, nullptr)){};
+    template <typename Y, typename = std::enable_if_t<std::is_convertible_v<Y*, T*>>>
+    CollectableSharedPtr(CollectableSharedPtr<Y>&& other) noexcept
+        : block_(other.GetBlock()), ptr_(other.Get()) {
+        other.CreateNullObject();
+    };
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // `operator=`-s
+
+    CollectableSharedPtr& operator=(const CollectableSharedPtr& other) {
+        if (&other == this) {
+            return *this;
+        }
+
+        if (other.block_) {
+            other.block_->IncStrong();
+        }
+        DeleteBlock();
+        block_ = other.block_;
+        ptr_ = other.ptr_;
+
+        return *this;
+    };
+    CollectableSharedPtr& operator=(CollectableSharedPtr&& other) noexcept {
+        if (&other == this) {
+            return *this;
+        }
+
+        DeleteBlock();
+        std::swap(block_, other.block_);
+        std::swap(ptr_, other.ptr_);
+
+        return *this;
+    };
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Destructor
+
+    ~CollectableSharedPtr() {
+        DeleteBlock();
+    };
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Modifiers
+
+    void Reset() {
+        DeleteBlock();
+    };
+    void Swap(CollectableSharedPtr& other) {
+        std::swap(block_, other.block_);
+        std::swap(ptr_, other.ptr_);
+    };
+    void CreateNullObject() {
+        block_ = nullptr;
+        ptr_ = nullptr;
+    };
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    CollectableBlockBase* GetBlock() const {
+        return block_;
+    };
+    T* Get() const {
+        return ptr_;
+    };
+    T& operator*() const {
+        return *ptr_;
+    };
+    T* operator->() const {
+        return ptr_;
+    };
+    size_t UseCount() const {
+        return block_ ? block_->StrongCount() : 0;
+    };
+    explicit operator bool() const {
+        return block_ != nullptr;
+    };
+
+private:
+    CollectableBlockBase* block_ = nullptr;
+    T* ptr_ = nullptr;
+
+    void DeleteBlock() {
+        if (block_) {
+            block_->ReleaseStrong();
+            block_ = nullptr;
+        }
+        ptr_ = nullptr;
+    }
+};
+
+template <typename T>
+struct IsTriviallyRelocatable<CollectableSharedPtr<T>> : std::true_type {};
+
+// The object shares one allocation with its block, like MakeShared.
+template <typename T, typename... Args>
+CollectableSharedPtr<T> MakeCollectableIn(CycleCollector& collector, Args&&... args) {
+    static_assert(!std::is_array_v<T>, "collectable arrays are not supported");
+    auto block = new cycle_detail::Block<T>(CountPolicy::kAtomic, std::forward<Args>(args)...);
+    block->collector = &collector;
+    if constexpr (cycle_detail::HasTrace<T>::value) {
+        block->trace = &cycle_detail::TraceObject<T>;
+    }
+    return CollectableSharedPtr<T>(block, block->GetPtr());
+};
+
+template <typename T, typename... Args>
+CollectableSharedPtr<T> MakeCollectable(Args&&... args) {
+    return MakeCollectableIn<T>(CycleCollector::Global(), std::forward<Args>(args)...);
+};
+
+template <typename T, typename U>
+inline bool operator==(const CollectableSharedPtr<T>& left, const CollectableSharedPtr<U>& right) {
+    return left.GetBlock() == right.GetBlock();
+};
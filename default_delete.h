@@ -0,0 +1,33 @@
+#pragma once
+
+// Deleter shared by UniquePtr and the intrusive reference counters.
+//
+// DefaultDelete<T> / DefaultDelete<T[]> are UniquePtr's deleters. DefaultDelete<> deletes any
+// object; it is also the deletion policy of RefCounted / WeakRefCounted (see intrusive.h), which
+// call Deleter::Destroy.
+template <typename T = void>
+struct DefaultDelete {
+    void operator()(T* ptr) const {
+        delete ptr;
+    }
+};
+
+template <typename T>
+struct DefaultDelete<T[]> {
+    void operator()(T* ptr) const {
+        delete[] ptr;
+    }
+};
+
+template <>
+struct DefaultDelete<void> {
+    template <typename T>
+    void operator()(T* ptr) const {
+        delete ptr;
+    }
+
+    template <typename T>
+    static void Destroy(T* object) {
+        delete object;
+    }
+};
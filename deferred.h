@@ -0,0 +1,221 @@
+#pragma once
+
+#include "shared.h"
+#include "unique.h"
+
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+// Deferred destruction: the last owner of a large object only queues it, and a ReclaimerThread
+// (or whoever calls DrainDeferred) runs the destructor later. Dropping a multi-megabyte tree then
+// costs a latency-critical thread one compare-and-swap instead of the whole teardown.
+//
+// Two ways in:
+//   - Control block mode, for SharedPtr: MakeSharedDeferred<T>(args...) and
+//     AdoptSharedDeferred(ptr). The block's kDestroyObject step queues the block itself, so
+//     nothing is allocated on the way out. WeakPtrs see the object expire at once, as usual.
+//   - DeferredDelete<T>, a deleter for UniquePtr or SharedPtr(ptr, deleter). It queues a small
+//     node from the control block pool, and falls back to deleting inline if that fails.
+//
+// Destructors run on the draining thread, so they must not care which thread that is. Objects
+// still queued at exit are not destroyed unless someone drains them.
+
+// Something waiting to be destroyed. `reclaim` destroys it and whatever the node belongs to.
+struct DeferredNode {
+    void (*reclaim)(DeferredNode*) = nullptr;
+    DeferredNode* next = nullptr;
+};
+
+// Lock-free queue of deferred destructions: any thread pushes, any thread drains.
+class DeferredReclaimer {
+public:
+    DeferredReclaimer() = default;
+
+    DeferredReclaimer(const DeferredReclaimer&) = delete;
+    DeferredReclaimer& operator=(const DeferredReclaimer&) = delete;
+
+    // Used by everything in this file. Never destroyed, objects may be dropped during static
+    // destruction.
+    static DeferredReclaimer& Global() {
+        static auto* reclaimer = new DeferredReclaimer();
+        return *reclaimer;
+    };
+
+    // One CAS loop, never blocks and never allocates.
+    void Push(DeferredNode* node) {
+        node->next = head_.load(std::memory_order_relaxed);
+        while (!head_.compare_exchange_weak(node->next, node, std::memory_order_release,
+                                            std::memory_order_relaxed)) {
+        }
+    };
+
+    // Destroys everything queued so far, oldest first, and whatever those destructors queue in
+    // turn. Returns the number of objects destroyed.
+    size_t Drain() {
+        size_t drained = 0;
+        while (DeferredNode* newest = head_.exchange(nullptr, std::memory_order_acquire)) {
+            DeferredNode* oldest = nullptr;
+            while (newest) {
+                DeferredNode* next = newest->next;
+                newest->next = oldest;
+                oldest = newest;
+                newest = next;
+            }
+            while (oldest) {
+                DeferredNode* next = oldest->next;
+                oldest->reclaim(oldest);
+                oldest = next;
+                ++drained;
+            }
+        }
+        return drained;
+    };
+
+    bool Empty() const {
+        return head_.load(std::memory_order_relaxed) == nullptr;
+    };
+
+private:
+    std::atomic<DeferredNode*> head_{nullptr};
+};
+
+inline size_t DrainDeferred() {
+    return DeferredReclaimer::Global().Drain();
+}
+
+// Background reclaimer: drains the global queue until destroyed, sleeping `interval` whenever it
+// finds the queue empty. Pushing never wakes it, that would put a system call on the hot path.
+class ReclaimerThread {
+public:
+    static constexpr std::chrono::microseconds kDefaultInterval{1000};
+
+    explicit ReclaimerThread(std::chrono::microseconds interval = kDefaultInterval)
+        : thread_([this, interval] {
+              while (!stop_.load(std::memory_order_acquire)) {
+                  if (DrainDeferred() == 0) {
+                      std::this_thread::sleep_for(interval);
+                  }
+              }
+              DrainDeferred();
+          }){};
+
+    ReclaimerThread(const ReclaimerThread&) = delete;
+    ReclaimerThread& operator=(const ReclaimerThread&) = delete;
+
+    // Returns once everything queued before the call is destroyed.
+    ~ReclaimerThread() {
+        stop_.store(true, std::memory_order_release);
+        thread_.join();
+    };
+
+private:
+    std::atomic<bool> stop_{false};
+    std::thread thread_;  // last, it starts running in the constructor
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Control block mode
+
+// ControlBlockPointer / ControlBlockEmplace / ControlBlockDeleter whose object is destroyed by
+// the reclaimer. The block queues itself, holding an extra weak reference so that it, and an
+// emplaced object with it, stays allocated until the reclaimer is done.
+template <typename Block>
+struct ControlBlockDeferred : public Block, private DeferredNode {
+    using Pointee = typename Block::Pointee;
+
+    template <typename... Args>
+    explicit ControlBlockDeferred(Args&&... args) : Block(std::forward<Args>(args)...) {
+        this->ops = OpsFor<&Manage, Pointee>(this->ops->policy);
+        this->reclaim = &Reclaim;
+    };
+
+    static void Manage(ControlBlockBase* base, BlockOp op) {
+        auto* self = static_cast<ControlBlockDeferred*>(base);
+        if (op == BlockOp::kDestroyObject) {
+            self->IncWeak();
+            DeferredReclaimer::Global().Push(self);
+        } else {
+            delete self;
+        }
+    }
+
+private:
+    static void Reclaim(DeferredNode* node) {
+        auto* self = static_cast<ControlBlockDeferred*>(node);
+        Block::Manage(self, BlockOp::kDestroyObject);
+        self->ReleaseWeak();
+    }
+};
+
+template <typename T, CountPolicy Policy = CountPolicy::kAtomic, typename... Args>
+SharedPtr<T> MakeSharedDeferred(Args&&... args) {
+    using Block = ControlBlockDeferred<ControlBlockEmplace<T, ControlBlockBaseFor<Policy>>>;
+    auto* block = new Block(Policy, std::forward<Args>(args)...);
+    return SharedPtr<T>(block, block->GetPtr());
+};
+
+// Takes over `ptr`, which is deleted by the reclaimer. Deleted at once if the block cannot be
+// allocated.
+template <typename T>
+SharedPtr<T> AdoptSharedDeferred(T* ptr) {
+    ControlBlockBase* block = nullptr;
+    try {
+        block = new ControlBlockDeferred<ControlBlockPointer<T>>(ptr);
+    } catch (...) {
+        delete ptr;
+        throw;
+    }
+    return SharedPtr<T>(block, ptr);
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Deleter mode
+
+// Queues the pointer for `Inner` to delete on the reclaimer. Derives from Inner, so it is as
+// empty as Inner is and UniquePtr<T, DeferredDelete<T>> stays one pointer.
+template <typename T, typename Inner = DefaultDelete<T>>
+struct DeferredDelete : private Inner {
+    using ElementType = std::remove_extent_t<T>;
+
+    DeferredDelete() = default;
+    explicit DeferredDelete(Inner inner) : Inner(std::move(inner)){};
+
+    void operator()(ElementType* ptr) const {
+        if (!ptr) {
+            return;
+        }
+        Node* node = nullptr;
+        try {
+            node = ::new (ControlBlockPool::Allocate(sizeof(Node))) Node(ptr, *this);
+        } catch (...) {
+            // A deleter must not throw, so the caller pays for the destructor after all
+            static_cast<const Inner&>(*this)(ptr);
+            return;
+        }
+        DeferredReclaimer::Global().Push(node);
+    }
+
+private:
+    struct Node : DeferredNode {
+        Node(ElementType* ptr, const Inner& inner) : ptr(ptr), inner(inner) {
+            reclaim = &Reclaim;
+        };
+
+        static void Reclaim(DeferredNode* base) {
+            auto* self = static_cast<Node*>(base);
+            self->inner(self->ptr);
+            self->~Node();
+            ControlBlockPool::Free(self, sizeof(Node));
+        }
+
+        ElementType* ptr;
+        Inner inner;
+    };
+};
+
+template <typename T, typename Inner>
+struct IsTriviallyRelocatable<DeferredDelete<T, Inner>> : IsTriviallyRelocatable<Inner> {};
@@ -0,0 +1,314 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <stdio.h>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Opt-in accounting of smart pointer activity per pointee type: control blocks, reference count
+// traffic, failed locks and live objects. Compiled in only when SMART_POINTERS_INSTRUMENT is
+// defined (the CMake option of the same name defines it for the library target), and it has to
+// be defined the same way in every translation unit. Without it the hooks expand to nothing and
+// SnapshotPointerStats() is always empty.
+//
+// SharedPtr / WeakPtr events are charged to the type the control block was made for, intrusive
+// ones to the class passed to RefCounted / WeakRefCounted (to T for IntrusiveWeakPtr<T>, which
+// normally is that class). Intrusive "blocks" are the side blocks of WeakRefCounted. The
+// references a block starts out with are not counted as increments.
+//
+// Each thread counts into slots of its own with plain relaxed stores; a snapshot adds all
+// threads' slots up. The exception is the peak of live objects, which needs a global view: each
+// thread folds its creations and destructions into the type's running total every kLiveBatch
+// events only, so `peak` may miss up to kLiveBatch objects per thread.
+
+enum class PointerEvent : uint8_t {
+    kBlockAlloc,
+    kBlockFree,
+    kStrongInc,
+    kStrongDec,
+    kWeakInc,
+    kWeakDec,
+    kLockFailure,
+    kObjectCreate,
+    kObjectDestroy,
+};
+
+inline constexpr size_t kPointerEventCount = 9;
+
+struct PointerTypeStats {
+    uint64_t Count(PointerEvent event) const {
+        return counts[static_cast<size_t>(event)];
+    }
+
+    std::string type;
+    uint64_t counts[kPointerEventCount] = {};
+    int64_t live = 0;
+    int64_t peak = 0;
+};
+
+#ifdef SMART_POINTERS_INSTRUMENT
+
+namespace instrument_detail {
+
+inline constexpr size_t kMaxTypes = 1024;
+inline constexpr int64_t kLiveBatch = 64;
+
+// Name of T as the compiler spells it, cut out of the function signature.
+template <typename T>
+std::string_view TypeNameOf() {
+    std::string_view signature = __PRETTY_FUNCTION__;
+    size_t start = signature.find("T = ");
+    if (start == std::string_view::npos) {
+        return signature;
+    }
+    start += 4;
+    size_t end = signature.find("; ", start);
+    if (end == std::string_view::npos) {
+        end = signature.rfind(']');
+    }
+    return signature.substr(start, end - start);
+}
+
+// One per pointee type. Constant-initialized, so hooks may fire during static initialization;
+// the type gets an index on its first event.
+struct TypeInfo {
+    constexpr explicit TypeInfo(std::string_view (*name)()) : name(name){};
+
+    std::string_view (*name)();
+    std::atomic<size_t> index_plus_one{0};
+    std::atomic<int64_t> live{0};  // as folded in by the threads, see kLiveBatch
+    std::atomic<int64_t> peak{0};
+};
+
+template <typename T>
+inline TypeInfo kTypeInfo{&TypeNameOf<T>};
+
+struct Counters {
+    std::atomic<uint64_t> counts[kPointerEventCount] = {};
+    int64_t pending_live = 0;  // owner thread only
+};
+
+struct ThreadSlots {
+    std::atomic<Counters*> slots[kMaxTypes] = {};
+};
+
+// Types past kMaxTypes share the last slot.
+inline std::string_view OtherTypesName() {
+    return "(other types)";
+}
+
+struct Registry {
+    std::mutex mutex;
+    std::vector<TypeInfo*> types;
+    std::vector<ThreadSlots*> threads;
+    std::vector<Counters*> retired;  // totals of exited threads, by type index
+};
+
+// Never destroyed: threads may exit, and count, during static destruction.
+inline Registry& GlobalRegistry() {
+    static auto* registry = new Registry();
+    return *registry;
+}
+
+inline TypeInfo kOtherTypes{&OtherTypesName};
+
+inline size_t IndexOf(TypeInfo& info) {
+    size_t index = info.index_plus_one.load(std::memory_order_acquire);
+    if (index != 0) {
+        return index - 1;
+    }
+
+    Registry& registry = GlobalRegistry();
+    std::lock_guard guard(registry.mutex);
+    index = info.index_plus_one.load(std::memory_order_relaxed);
+    if (index == 0) {
+        if (registry.types.size() + 1 < kMaxTypes) {
+            registry.types.push_back(&info);
+            registry.retired.push_back(new Counters());
+            index = registry.types.size();
+        } else {
+            if (registry.types.size() < kMaxTypes) {
+                registry.types.push_back(&kOtherTypes);
+                registry.retired.push_back(new Counters());
+            }
+            index = kMaxTypes;
+        }
+        info.index_plus_one.store(index, std::memory_order_release);
+    }
+    return index - 1;
+}
+
+inline void UpdatePeak(TypeInfo& info, int64_t live) {
+    int64_t peak = info.peak.load(std::memory_order_relaxed);
+    while (live > peak &&
+           !info.peak.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {
+    }
+}
+
+inline void FlushLive(TypeInfo& info, Counters& counters) {
+    int64_t pending = std::exchange(counters.pending_live, 0);
+    UpdatePeak(info, info.live.fetch_add(pending, std::memory_order_relaxed) + pending);
+}
+
+inline void Bump(Counters& counters, PointerEvent event) {
+    auto& count = counters.counts[static_cast<size_t>(event)];
+    count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+class ThreadState {
+public:
+    // Slots of the calling thread, nullptr once it is shutting down.
+    static ThreadSlots* Current() {
+        if (current_ == nullptr && !exited_) {
+            static thread_local ThreadExit exit_guard;
+            current_ = new ThreadSlots();
+            Registry& registry = GlobalRegistry();
+            std::lock_guard guard(registry.mutex);
+            registry.threads.push_back(current_);
+        }
+        return current_;
+    }
+
+private:
+    // Moves the thread's counts into `retired`. Events after this point go there directly.
+    struct ThreadExit {
+        ~ThreadExit() {
+            ThreadSlots* slots = current_;
+            current_ = nullptr;
+            exited_ = true;
+
+            Registry& registry = GlobalRegistry();
+            std::lock_guard guard(registry.mutex);
+            registry.threads.erase(
+                std::find(registry.threads.begin(), registry.threads.end(), slots));
+            for (size_t index = 0; index < registry.types.size(); ++index) {
+                Counters* counters = slots->slots[index].load(std::memory_order_relaxed);
+                if (counters == nullptr) {
+                    continue;
+                }
+                Counters& retired = *registry.retired[index];
+                for (size_t event = 0; event < kPointerEventCount; ++event) {
+                    retired.counts[event].fetch_add(
+                        counters->counts[event].load(std::memory_order_relaxed),
+                        std::memory_order_relaxed);
+                }
+                FlushLive(*registry.types[index], *counters);
+                delete counters;
+            }
+            delete slots;
+        }
+    };
+
+    static inline thread_local ThreadSlots* current_ = nullptr;
+    static inline thread_local bool exited_ = false;
+};
+
+inline void Record(TypeInfo& info, PointerEvent event) {
+    size_t index = IndexOf(info);
+    TypeInfo& charged = index == kMaxTypes - 1 ? kOtherTypes : info;
+    ThreadSlots* slots = ThreadState::Current();
+
+    Counters* counters;
+    if (slots == nullptr) {
+        // The thread is exiting: count straight into the totals.
+        Registry& registry = GlobalRegistry();
+        std::lock_guard guard(registry.mutex);
+        counters = registry.retired[index];
+        counters->counts[static_cast<size_t>(event)].fetch_add(1, std::memory_order_relaxed);
+        if (event == PointerEvent::kObjectCreate || event == PointerEvent::kObjectDestroy) {
+            counters->pending_live += event == PointerEvent::kObjectCreate ? 1 : -1;
+            FlushLive(charged, *counters);
+        }
+        return;
+    }
+
+    counters = slots->slots[index].load(std::memory_order_relaxed);
+    if (counters == nullptr) {
+        counters = new Counters();
+        slots->slots[index].store(counters, std::memory_order_release);
+    }
+    Bump(*counters, event);
+    if (event == PointerEvent::kObjectCreate || event == PointerEvent::kObjectDestroy) {
+        counters->pending_live += event == PointerEvent::kObjectCreate ? 1 : -1;
+        if (counters->pending_live >= kLiveBatch || counters->pending_live <= -kLiveBatch) {
+            FlushLive(charged, *counters);
+        }
+    }
+}
+
+}  // namespace instrument_detail
+
+// Hook used by the pointer headers, e.g.
+// SMART_POINTERS_RECORD(instrument_detail::kTypeInfo<T>, kStrongInc)
+#define SMART_POINTERS_RECORD(type_info, event) \
+    ::instrument_detail::Record(type_info, PointerEvent::event)
+
+// Adds up every thread's counts. Takes a lock that threads only take when they start or exit.
+inline std::vector<PointerTypeStats> SnapshotPointerStats() {
+    using namespace instrument_detail;
+    Registry& registry = GlobalRegistry();
+    std::lock_guard guard(registry.mutex);
+
+    std::vector<PointerTypeStats> snapshot(registry.types.size());
+    for (size_t index = 0; index < registry.types.size(); ++index) {
+        PointerTypeStats& stats = snapshot[index];
+        TypeInfo& info = *registry.types[index];
+        stats.type = std::string(info.name());
+
+        auto add = [&stats](const Counters& counters) {
+            for (size_t event = 0; event < kPointerEventCount; ++event) {
+                stats.counts[event] += counters.counts[event].load(std::memory_order_acquire);
+            }
+        };
+        add(*registry.retired[index]);
+        for (ThreadSlots* slots : registry.threads) {
+            if (Counters* counters = slots->slots[index].load(std::memory_order_acquire)) {
+                add(*counters);
+            }
+        }
+
+        stats.live = static_cast<int64_t>(stats.Count(PointerEvent::kObjectCreate) -
+                                          stats.Count(PointerEvent::kObjectDestroy));
+        UpdatePeak(info, stats.live);
+        stats.peak = info.peak.load(std::memory_order_relaxed);
+    }
+    return snapshot;
+}
+
+#else
+
+#define SMART_POINTERS_RECORD(type_info, event) ((void)0)
+
+inline std::vector<PointerTypeStats> SnapshotPointerStats() {
+    return {};
+}
+
+#endif
+
+// One line per type, the types with the most live objects first.
+inline void DumpPointerStats(FILE* out = stderr) {
+    std::vector<PointerTypeStats> snapshot = SnapshotPointerStats();
+    std::sort(snapshot.begin(), snapshot.end(),
+              [](const PointerTypeStats& a, const PointerTypeStats& b) { return a.live > b.live; });
+
+    fprintf(out, "%-40s %10s %10s %12s %12s %10s %10s %8s %10s %10s\n", "type", "blocks+",
+            "blocks-", "strong+", "strong-", "weak+", "weak-", "lock!", "live", "peak");
+    for (const PointerTypeStats& stats : snapshot) {
+        fprintf(out, "%-40s %10llu %10llu %12llu %12llu %10llu %10llu %8llu %10lld %10lld\n",
+                stats.type.c_str(),
+                static_cast<unsigned long long>(stats.Count(PointerEvent::kBlockAlloc)),
+                static_cast<unsigned long long>(stats.Count(PointerEvent::kBlockFree)),
+                static_cast<unsigned long long>(stats.Count(PointerEvent::kStrongInc)),
+                static_cast<unsigned long long>(stats.Count(PointerEvent::kStrongDec)),
+                static_cast<unsigned long long>(stats.Count(PointerEvent::kWeakInc)),
+                static_cast<unsigned long long>(stats.Count(PointerEvent::kWeakDec)),
+                static_cast<unsigned long long>(stats.Count(PointerEvent::kLockFailure)),
+                static_cast<long long>(stats.live), static_cast<long long>(stats.peak));
+    }
+}
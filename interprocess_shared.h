@@ -0,0 +1,569 @@
+#pragma once
+
+#include "offset_ptr.h"
+#include "sw_fwd.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstddef>  // std::nullptr_t
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// SharedPtr across processes: the control block and the object live in a shared memory segment
+// (shm_open + mmap), so worker processes on one host share one copy of a read-mostly table and
+// count their references to it in place.
+//
+//     auto segment = SharedMemorySegment::Create("/tables", 64 << 20);
+//     segment.Publish("routes", segment.MakeShared<RouteTable>(segment, ...));
+//     // in another process
+//     auto segment = SharedMemorySegment::Open("/tables");
+//     InterprocessSharedPtr<RouteTable> routes = segment.Find<RouteTable>("routes");
+//
+// Blocks have ControlBlockEmplace's layout: a 16-byte header whose first word is the same
+// strong/weak count word as ControlBlockBase, counted atomically, and the object right after it
+// at ControlBlockEmplace::kStorageOffset. The second word, the BlockOps pointer in a process-local
+// block, is a hash of the type's name here, checked by Find. Every pointer into the segment is an
+// OffsetPtr, so the segment may be mapped at a different address in every process (or twice in
+// one), and an InterprocessSharedPtr may itself be stored in the segment, as a member of a
+// shared object.
+//
+// Objects in the segment must not hold raw pointers, vtables or process-local handles; the
+// destructor runs in whichever process drops the last reference, which has to be built with
+// the same definition of T. A process that dies holding references leaks them, and one that dies
+// inside the allocator leaves its lock taken.
+
+class SharedMemorySegment;
+
+template <typename T>
+class InterprocessSharedPtr;
+
+// Find<T> for a name published with another type
+class BadSegmentType : public std::exception {};
+
+namespace interprocess_detail {
+
+// The segment's allocation granularity, and the largest alignment an object in it can have.
+inline constexpr size_t kAlignment = 16;
+
+// FNV-1a of the compiler's spelling of T: the same in every process built by the same compiler.
+template <typename T>
+constexpr uint64_t TypeHash() {
+    const char* name = __PRETTY_FUNCTION__;
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; name[i] != '\0'; ++i) {
+        hash = (hash ^ static_cast<unsigned char>(name[i])) * 1099511628211ull;
+    }
+    return hash;
+}
+
+struct Block {
+    std::atomic<uint64_t> counts;  // as ControlBlockBase::counts
+    uint64_t type;                 // TypeHash of the object's type
+};
+
+static_assert(sizeof(Block) == sizeof(ControlBlockBase), "blocks keep the ControlBlockBase layout");
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+              "counts shared between processes need address-free, lock-free atomics");
+
+// In front of every allocation. `base` finds the segment from the chunk, so memory can be freed
+// knowing nothing but its address.
+struct Chunk {
+    uint64_t size;  // including this header
+    uint64_t base;  // distance back to the segment header
+};
+
+static_assert(sizeof(Chunk) == kAlignment);
+
+// At offset 0 of the segment. Aligned so that the first chunk after it is.
+struct alignas(kAlignment) SegmentHeader {
+    static constexpr uint64_t kMagic = 0x3130'4d48'535f'5053;  // "SP_SHM01"
+    static constexpr size_t kClasses = 64;
+    static constexpr size_t kMaxRoots = 32;
+    static constexpr size_t kMaxRootName = 47;
+
+    struct Root {
+        char name[kMaxRootName + 1];
+        uint64_t block;  // offset from the segment header, 0 for a free slot
+    };
+
+    std::atomic<uint64_t> magic;  // set last by Create
+    uint64_t size;
+    std::atomic<uint32_t> lock;
+    uint64_t bump;       // offset of the first byte never handed out
+    uint64_t allocated;  // bytes in live chunks, headers included
+    // Freed chunks by floor(log2(size)), linked through their first payload word. Chunks are
+    // neither split nor merged: meant for tables made once and blocks of a handful of sizes.
+    uint64_t free_lists[kClasses];
+    Root roots[kMaxRoots];
+
+    char* Base() {
+        return reinterpret_cast<char*>(this);
+    }
+
+    // A spin lock: a process-shared pthread mutex would not recover from a dead owner either.
+    void Lock() {
+        while (lock.exchange(1, std::memory_order_acquire) != 0) {
+            while (lock.load(std::memory_order_relaxed) != 0) {
+            }
+        }
+    }
+    void Unlock() {
+        lock.store(0, std::memory_order_release);
+    }
+
+    void* Allocate(size_t bytes) {
+        if (bytes > size) {
+            throw std::bad_alloc();
+        }
+        uint64_t total = (bytes + sizeof(Chunk) + kAlignment - 1) / kAlignment * kAlignment;
+        Lock();
+        uint64_t offset = TakeFree(total);
+        if (offset == 0) {
+            if (total > size - bump) {
+                Unlock();
+                throw std::bad_alloc();
+            }
+            offset = bump;
+            bump += total;
+            *ChunkAt(offset) = Chunk{total, offset};
+        }
+        allocated += ChunkAt(offset)->size;
+        Unlock();
+        return ChunkAt(offset) + 1;
+    }
+
+    void Deallocate(Chunk* chunk) {
+        uint64_t offset = reinterpret_cast<char*>(chunk) - Base();
+        size_t size_class = FloorLog2(chunk->size);
+        Lock();
+        allocated -= chunk->size;
+        *NextFree(offset) = free_lists[size_class];
+        free_lists[size_class] = offset;
+        Unlock();
+    }
+
+private:
+    static size_t FloorLog2(uint64_t value) {
+        return 63 - __builtin_clzll(value);
+    }
+
+    Chunk* ChunkAt(uint64_t offset) {
+        return reinterpret_cast<Chunk*>(Base() + offset);
+    }
+    uint64_t* NextFree(uint64_t offset) {
+        return reinterpret_cast<uint64_t*>(ChunkAt(offset) + 1);
+    }
+
+    // First fit among the chunks of total's own class, else any chunk of the next class up,
+    // which is always large enough. 0 if there is none.
+    uint64_t TakeFree(uint64_t total) {
+        size_t size_class = FloorLog2(total);
+        for (uint64_t* link = &free_lists[size_class]; *link != 0; link = NextFree(*link)) {
+            if (ChunkAt(*link)->size >= total) {
+                uint64_t offset = *link;
+                *link = *NextFree(offset);
+                return offset;
+            }
+        }
+        if (size_class + 1 < kClasses && free_lists[size_class + 1] != 0) {
+            uint64_t offset = free_lists[size_class + 1];
+            free_lists[size_class + 1] = *NextFree(offset);
+            return offset;
+        }
+        return 0;
+    }
+};
+
+inline SegmentHeader* HeaderOf(const void* memory) {
+    auto* chunk = static_cast<const Chunk*>(memory) - 1;
+    return reinterpret_cast<SegmentHeader*>(const_cast<char*>(
+        reinterpret_cast<const char*>(chunk) - chunk->base));
+}
+
+}  // namespace interprocess_detail
+
+// An InterprocessSharedPtr is one OffsetPtr to the block, like CompactSharedPtr the object's
+// address follows from the block's.
+template <typename T>
+class InterprocessSharedPtr {
+    static_assert(!std::is_array_v<T>, "InterprocessSharedPtr holds a single object");
+    static_assert(!std::is_polymorphic_v<T>,
+                  "a vtable pointer only means something in the process that wrote it");
+    static_assert(alignof(T) <= interprocess_detail::kAlignment,
+                  "the segment aligns allocations to 16 bytes");
+
+    using Block = interprocess_detail::Block;
+
+public:
+    // Where ControlBlockEmplace<T> keeps the object
+    static constexpr size_t kStorageOffset = ControlBlockEmplace<T>::kStorageOffset;
+    static_assert(kStorageOffsetMatches<ControlBlockEmplace<T>>);
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    InterprocessSharedPtr(){};
+    InterprocessSharedPtr(std::nullptr_t){};
+
+    InterprocessSharedPtr(const InterprocessSharedPtr& other) : block_(other.block_) {
+        if (Block* block = block_.Get()) {
+            block->counts.fetch_add(ControlBlockBase::kStrongOne, std::memory_order_relaxed);
+        }
+    };
+    InterprocessSharedPtr(InterprocessSharedPtr&& other) noexcept : block_(other.block_) {
+        other.block_ = nullptr;
+    };
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // `operator=`-s
+
+    InterprocessSharedPtr& operator=(const InterprocessSharedPtr& other) {
+        if (&other == this) {
+            return *this;
+        }
+        InterprocessSharedPtr(other).Swap(*this);
+        return *this;
+    };
+    InterprocessSharedPtr& operator=(InterprocessSharedPtr&& other) noexcept {
+        if (&other == this) {
+            return *this;
+        }
+        Reset();
+        Swap(other);
+        return *this;
+    };
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Destructor
+
+    ~InterprocessSharedPtr() {
+        Reset();
+    };
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Modifiers
+
+    // The last reference destroys the object and returns the block to its segment
+    void Reset() {
+        Block* block = block_.Get();
+        if (!block) {
+            return;
+        }
+        block_ = nullptr;
+
+        constexpr uint64_t kStrongOne = ControlBlockBase::kStrongOne;
+        if (block->counts.fetch_sub(kStrongOne, std::memory_order_acq_rel) - kStrongOne >=
+            kStrongOne) {
+            return;
+        }
+        std::destroy_at(ObjectOf(block));
+        // The weak reference all strong owners share, as in ControlBlockBase
+        uint64_t left = block->counts.fetch_sub(ControlBlockBase::kWeakOne,
+                                                std::memory_order_acq_rel) -
+                        ControlBlockBase::kWeakOne;
+        if ((left & ControlBlockBase::kWeakMask) == 0) {
+            block->~Block();
+            interprocess_detail::HeaderOf(block)->Deallocate(
+                static_cast<interprocess_detail::Chunk*>(static_cast<void*>(block)) - 1);
+        }
+    };
+    void Swap(InterprocessSharedPtr& other) {
+        Block* mine = block_.Get();
+        block_ = other.block_;
+        other.block_ = mine;
+    };
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    T* Get() const {
+        Block* block = block_.Get();
+        return block ? ObjectOf(block) : nullptr;
+    };
+    T& operator*() const {
+        return *Get();
+    };
+    T* operator->() const {
+        return Get();
+    };
+    size_t UseCount() const {
+        Block* block = block_.Get();
+        if (!block) {
+            return 0;
+        }
+        return block->counts.load(std::memory_order_relaxed) >> ControlBlockBase::kStrongShift;
+    };
+    explicit operator bool() const {
+        return static_cast<bool>(block_);
+    };
+
+private:
+    friend class SharedMemorySegment;
+
+    // Adopts a strong reference the caller holds
+    explicit InterprocessSharedPtr(Block* block) : block_(block){};
+
+    OffsetPtr<Block> block_;
+
+    static T* ObjectOf(Block* block) {
+        return std::launder(reinterpret_cast<T*>(reinterpret_cast<char*>(block) + kStorageOffset));
+    }
+};
+
+// By address: pointers reached through different mappings of one segment compare unequal
+template <typename T, typename U>
+inline bool operator==(const InterprocessSharedPtr<T>& left,
+                       const InterprocessSharedPtr<U>& right) {
+    return left.Get() == right.Get();
+};
+
+// A process's mapping of a named POSIX shared memory segment. Move-only; unmapping leaves the
+// segment and everything in it alone, Unlink removes the name once every process is done with it.
+class SharedMemorySegment {
+    using Header = interprocess_detail::SegmentHeader;
+
+public:
+    // Fails with std::system_error if `name` exists already
+    static SharedMemorySegment Create(const std::string& name, size_t size) {
+        if (size < sizeof(Header)) {
+            size = sizeof(Header);
+        }
+        size = (size + interprocess_detail::kAlignment - 1) / interprocess_detail::kAlignment *
+               interprocess_detail::kAlignment;
+        int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd < 0) {
+            ThrowErrno("shm_open");
+        }
+        if (ftruncate(fd, static_cast<off_t>(size)) != 0) {
+            int error = errno;
+            close(fd);
+            shm_unlink(name.c_str());
+            ThrowErrno("ftruncate", error);
+        }
+        SharedMemorySegment segment(Map(fd, size), size);
+
+        // ftruncate zeroed it: empty free lists and roots
+        Header* header = segment.header_;
+        header->size = size;
+        header->bump = sizeof(Header);
+        header->magic.store(Header::kMagic, std::memory_order_release);
+        return segment;
+    };
+
+    static SharedMemorySegment Open(const std::string& name) {
+        int fd = shm_open(name.c_str(), O_RDWR, 0);
+        if (fd < 0) {
+            ThrowErrno("shm_open");
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0) {
+            int error = errno;
+            close(fd);
+            ThrowErrno("fstat", error);
+        }
+        size_t size = static_cast<size_t>(info.st_size);
+        if (size < sizeof(Header)) {
+            close(fd);
+            throw std::system_error(EINVAL, std::generic_category(), "not a segment");
+        }
+        SharedMemorySegment segment(Map(fd, size), size);
+        Header* header = segment.header_;
+        if (header->magic.load(std::memory_order_acquire) != Header::kMagic ||
+            header->size != size) {
+            throw std::system_error(EINVAL, std::generic_category(), "not a segment");
+        }
+        return segment;
+    };
+
+    static void Unlink(const std::string& name) {
+        shm_unlink(name.c_str());
+    };
+
+    SharedMemorySegment(SharedMemorySegment&& other) noexcept
+        : header_(other.header_), size_(other.size_) {
+        other.header_ = nullptr;
+    };
+    SharedMemorySegment& operator=(SharedMemorySegment&& other) noexcept {
+        std::swap(header_, other.header_);
+        std::swap(size_, other.size_);
+        return *this;
+    };
+
+    ~SharedMemorySegment() {
+        if (header_) {
+            munmap(header_, size_);
+        }
+    };
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Allocation
+
+    // Segment memory aligned to kAlignment, throws std::bad_alloc when the segment is full
+    void* Allocate(size_t bytes) {
+        return header_->Allocate(bytes);
+    };
+    // Any memory from Allocate, from any process and any mapping of the segment
+    static void Deallocate(void* memory) {
+        if (memory) {
+            interprocess_detail::HeaderOf(memory)->Deallocate(
+                static_cast<interprocess_detail::Chunk*>(memory) - 1);
+        }
+    };
+
+    // A block with T in it, counted by every process that maps the segment
+    template <typename T, typename... Args>
+    InterprocessSharedPtr<T> MakeShared(Args&&... args) {
+        using Block = interprocess_detail::Block;
+        void* memory = Allocate(InterprocessSharedPtr<T>::kStorageOffset + sizeof(T));
+        auto* block = ::new (memory) Block{
+            {ControlBlockBase::kStrongOne | ControlBlockBase::kWeakOne},
+            interprocess_detail::TypeHash<T>()};
+        try {
+            ::new (static_cast<char*>(memory) + InterprocessSharedPtr<T>::kStorageOffset)
+                T(std::forward<Args>(args)...);
+        } catch (...) {
+            Deallocate(memory);
+            throw;
+        }
+        return InterprocessSharedPtr<T>(block);
+    };
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Named roots, how other processes find what is in the segment
+
+    // `ptr` has to be from this segment, through any mapping of it. The segment keeps its
+    // reference until Unpublish. Replaces an earlier root of the same name,
+    // which must hold a T as well (BadSegmentType otherwise). Throws std::length_error for a name
+    // over kMaxRootName characters or with every root slot in use.
+    template <typename T>
+    void Publish(const std::string& name, InterprocessSharedPtr<T> ptr) {
+        if (name.empty() || name.size() > Header::kMaxRootName) {
+            throw std::length_error("root names have 1 to kMaxRootName characters");
+        }
+        uint64_t offset = ptr ? Offset(ptr.block_.Get()) : 0;
+        header_->Lock();
+        Header::Root* root = FindRoot(name);
+        if (root && BlockAt(root->block)->type != interprocess_detail::TypeHash<T>()) {
+            header_->Unlock();
+            throw BadSegmentType();
+        }
+        if (!root && offset != 0) {
+            root = FindRoot("");
+            if (!root) {
+                header_->Unlock();
+                throw std::length_error("no free root slot");
+            }
+            std::strcpy(root->name, name.c_str());
+        }
+        uint64_t replaced = 0;
+        if (root) {
+            replaced = root->block;
+            root->block = offset;
+            if (offset == 0) {
+                root->name[0] = '\0';
+            }
+        }
+        header_->Unlock();
+
+        ptr.block_ = nullptr;  // adopted by the root
+        if (replaced != 0) {
+            // Outside the lock, the destructor may free
+            InterprocessSharedPtr<T>(BlockAt(replaced)).Reset();
+        }
+    };
+
+    template <typename T>
+    void Unpublish(const std::string& name) {
+        Publish(name, InterprocessSharedPtr<T>());
+    };
+
+    // Empty if nothing is published under `name`, BadSegmentType if it holds something else
+    template <typename T>
+    InterprocessSharedPtr<T> Find(const std::string& name) const {
+        using Block = interprocess_detail::Block;
+        header_->Lock();
+        Header::Root* root = name.empty() ? nullptr : FindRoot(name);
+        if (!root) {
+            header_->Unlock();
+            return InterprocessSharedPtr<T>();
+        }
+        Block* block = BlockAt(root->block);
+        if (block->type != interprocess_detail::TypeHash<T>()) {
+            header_->Unlock();
+            throw BadSegmentType();
+        }
+        block->counts.fetch_add(ControlBlockBase::kStrongOne, std::memory_order_relaxed);
+        header_->Unlock();
+        return InterprocessSharedPtr<T>(block);
+    };
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    void* Base() const {
+        return header_;
+    };
+    size_t Size() const {
+        return size_;
+    };
+    // Bytes in live allocations, headers included
+    size_t Allocated() const {
+        header_->Lock();
+        size_t allocated = header_->allocated;
+        header_->Unlock();
+        return allocated;
+    };
+
+private:
+    Header* header_ = nullptr;
+    size_t size_ = 0;
+
+    SharedMemorySegment(Header* header, size_t size) : header_(header), size_(size){};
+
+    [[noreturn]] static void ThrowErrno(const char* what, int error = errno) {
+        throw std::system_error(error, std::generic_category(), what);
+    }
+
+    // The mapping keeps the segment open, the descriptor is not needed past mmap
+    static Header* Map(int fd, size_t size) {
+        void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        int error = errno;
+        close(fd);
+        if (memory == MAP_FAILED) {
+            ThrowErrno("mmap", error);
+        }
+        return static_cast<Header*>(memory);
+    }
+
+    // Through the chunk header, `memory` may come from another mapping of the segment
+    static uint64_t Offset(const void* memory) {
+        return static_cast<const char*>(memory) -
+               interprocess_detail::HeaderOf(memory)->Base();
+    }
+
+    // Under the lock
+    Header::Root* FindRoot(const std::string& name) const {
+        for (Header::Root& root : header_->roots) {
+            if (name == root.name) {
+                return &root;
+            }
+        }
+        return nullptr;
+    }
+
+    interprocess_detail::Block* BlockAt(uint64_t offset) const {
+        return reinterpret_cast<interprocess_detail::Block*>(header_->Base() + offset);
+    }
+};
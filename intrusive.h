@@ -1,6 +1,13 @@
 #pragma once
 
+#include "default_delete.h"
+#include "instrument.h"
+#include "object_pool.h"
+#include "relocatable.h"
+
+#include <atomic>
 #include <cstddef>  // for std::nullptr_t
+#include <cstdint>
 #include <utility>  // for std::exchange / std::swap
 #include <stddef.h>
 
@@ -26,28 +33,77 @@ private:
     size_t count_ = 0;
 };
 
-struct DefaultDelete {
+// Counter for objects shared between threads. DecRef returns the new value, so exactly one thread
+// sees the transition to zero.
+class ThreadSafeCounter {
+public:
+    ThreadSafeCounter() = default;
+    // A copy of an object is a new object, nobody refers to it yet
+    ThreadSafeCounter(const ThreadSafeCounter&){};
+    ThreadSafeCounter& operator=(const ThreadSafeCounter&) {
+        return *this;
+    };
+
+    // Orderings as in ControlBlockBase::Add / Subtract
+    size_t IncRef() {
+        return count_.fetch_add(1, std::memory_order_relaxed) + 1;
+    };
+    size_t DecRef() {
+        return count_.fetch_sub(1, std::memory_order_acq_rel) - 1;
+    };
+    size_t RefCount() const {
+        return count_.load(std::memory_order_relaxed);
+    };
+
+    ~ThreadSafeCounter() = default;
+
+private:
+    std::atomic<size_t> count_{0};
+};
+
+// Hands the object's memory back to ObjectPool instead of the heap. Objects using it must be
+// created with MakeIntrusivePooled<Derived>, Derived being the class passed to RefCounted.
+struct PooledDelete {
     template <typename T>
     static void Destroy(T* object) {
-        delete object;
+        object->~T();
+        ObjectPool<sizeof(T), alignof(T)>::Free(object);
     }
 };
 
+// Counts the live objects of Derived for instrument.h. Empty, and a no-op, unless
+// SMART_POINTERS_INSTRUMENT is defined.
+template <typename Derived>
+struct IntrusiveObjectTracker {
+#ifdef SMART_POINTERS_INSTRUMENT
+    IntrusiveObjectTracker() {
+        SMART_POINTERS_RECORD(instrument_detail::kTypeInfo<Derived>, kObjectCreate);
+    };
+    IntrusiveObjectTracker(const IntrusiveObjectTracker&) : IntrusiveObjectTracker(){};
+    IntrusiveObjectTracker& operator=(const IntrusiveObjectTracker&) = default;
+    ~IntrusiveObjectTracker() {
+        SMART_POINTERS_RECORD(instrument_detail::kTypeInfo<Derived>, kObjectDestroy);
+    };
+#endif
+};
+
 template <typename Derived, typename Counter, typename Deleter>
-class RefCounted {
+class RefCounted : private IntrusiveObjectTracker<Derived> {
 public:
     // Increase reference counter.
     void IncRef() {
+        SMART_POINTERS_RECORD(instrument_detail::kTypeInfo<Derived>, kStrongInc);
         counter_.IncRef();
     };
 
     // Decrease reference counter.
     // Destroy object using Deleter when the last instance dies.
+    // One decrement that reports the new value: reading RefCount() first would let two threads
+    // both see 2 and nobody destroy, or both see 1 and destroy twice.
     void DecRef() {
-        if (RefCount() <= 1) {
+        SMART_POINTERS_RECORD(instrument_detail::kTypeInfo<Derived>, kStrongDec);
+        if (counter_.DecRef() == 0) {
             deleter_.Destroy(static_cast<Derived*>(this));
-        } else {
-            counter_.DecRef();
         }
     };
 
@@ -63,9 +119,136 @@ private:
     Deleter deleter_;
 };
 
-template <typename Derived, typename D = DefaultDelete>
+template <typename Derived, typename D = DefaultDelete<>>
 using SimpleRefCounted = RefCounted<Derived, SimpleCounter, D>;
 
+template <typename Derived, typename D = DefaultDelete<>>
+using ThreadSafeRefCounted = RefCounted<Derived, ThreadSafeCounter, D>;
+
+// Side block of a WeakRefCounted object, created by its first IntrusiveWeakPtr. From then on it
+// holds the strong count as well, so a weak pointer can try to lock without touching an object
+// that may already be destroyed. It is freed once the weak count drops to zero.
+struct IntrusiveSideBlock {
+    explicit IntrusiveSideBlock(size_t strong) : strong(strong){};
+
+    bool IncStrongIfNonZero() {
+        size_t count = strong.load(std::memory_order_relaxed);
+        do {
+            if (count == 0) {
+                return false;
+            }
+        } while (!strong.compare_exchange_weak(count, count + 1, std::memory_order_relaxed));
+        return true;
+    }
+
+    void IncWeak() {
+        weak.fetch_add(1, std::memory_order_relaxed);
+    }
+    // Returns true if that freed the block.
+    bool ReleaseWeak() {
+        if (weak.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete this;
+            return true;
+        }
+        return false;
+    }
+
+    std::atomic<size_t> strong;
+    std::atomic<size_t> weak{1};  // weak pointers, plus one for all strong references together
+};
+
+// RefCounted that IntrusiveWeakPtr can observe. Thread-safe.
+//
+// `refs_` holds the strong count shifted left by one; the low bit is set for good once the first
+// IntrusiveWeakPtr has moved the count into an IntrusiveSideBlock. Adding or subtracting two never
+// touches that bit, so IncRef / DecRef stay a single fetch_add / fetch_sub and only look at the
+// side block when they see it set. The bits above it are garbage from then on. Objects that are
+// never observed pay one pointer of space and no allocation.
+template <typename Derived, typename Deleter = DefaultDelete<>>
+class WeakRefCounted : private IntrusiveObjectTracker<Derived> {
+public:
+    WeakRefCounted() = default;
+    // Copies start unreferenced, as in ThreadSafeCounter
+    WeakRefCounted(const WeakRefCounted&){};
+    WeakRefCounted& operator=(const WeakRefCounted&) {
+        return *this;
+    };
+
+    // acquire pairs with the release in WeakBlock, so a set kMoved bit comes with side_.
+    void IncRef() {
+        SMART_POINTERS_RECORD(instrument_detail::kTypeInfo<Derived>, kStrongInc);
+        if (refs_.fetch_add(kOne, std::memory_order_acquire) & kMoved) {
+            side_.load(std::memory_order_relaxed)->strong.fetch_add(1, std::memory_order_relaxed);
+        }
+    };
+
+    void DecRef() {
+        SMART_POINTERS_RECORD(instrument_detail::kTypeInfo<Derived>, kStrongDec);
+        uintptr_t word = refs_.fetch_sub(kOne, std::memory_order_acq_rel);
+        if (word & kMoved) {
+            IntrusiveSideBlock* side = side_.load(std::memory_order_relaxed);
+            if (side->strong.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                deleter_.Destroy(static_cast<Derived*>(this));
+                if (side->ReleaseWeak()) {
+                    SMART_POINTERS_RECORD(instrument_detail::kTypeInfo<Derived>, kBlockFree);
+                }
+            }
+        } else if (word == kOne) {
+            deleter_.Destroy(static_cast<Derived*>(this));
+        }
+    };
+
+    size_t RefCount() const {
+        uintptr_t word = refs_.load(std::memory_order_acquire);
+        if (word & kMoved) {
+            return side_.load(std::memory_order_relaxed)->strong.load(std::memory_order_relaxed);
+        }
+        return word / kOne;
+    };
+
+    // The side block, created on the first call. The caller must hold a strong reference.
+    //
+    // The block starts with a huge strong count, so references taken and dropped through it
+    // before the real count arrives cannot bring it to zero. Whoever sets kMoved first takes the
+    // inline count at that moment and swaps the bias for it. It holds a reference itself, so the
+    // result is never zero.
+    IntrusiveSideBlock* WeakBlock() {
+        IntrusiveSideBlock* side = side_.load(std::memory_order_acquire);
+        if (side == nullptr) {
+            auto* fresh = new IntrusiveSideBlock(kUnsettled);
+            if (side_.compare_exchange_strong(side, fresh, std::memory_order_acq_rel)) {
+                SMART_POINTERS_RECORD(instrument_detail::kTypeInfo<Derived>, kBlockAlloc);
+                side = fresh;
+            } else {
+                delete fresh;
+            }
+        }
+
+        if (!(refs_.load(std::memory_order_acquire) & kMoved)) {
+            uintptr_t word = refs_.fetch_or(kMoved, std::memory_order_acq_rel);
+            if (!(word & kMoved)) {
+                side->strong.fetch_sub(kUnsettled - word / kOne, std::memory_order_relaxed);
+            }
+        }
+        return side;
+    };
+
+    ~WeakRefCounted() = default;
+
+private:
+    static constexpr uintptr_t kMoved = 1;
+    static constexpr uintptr_t kOne = 2;
+    static constexpr size_t kUnsettled = size_t(1) << 62;
+
+    std::atomic<uintptr_t> refs_{0};
+    std::atomic<IntrusiveSideBlock*> side_{nullptr};
+    Deleter deleter_;
+};
+
+// Tag for taking over a reference the caller already owns, e.g. one given up by Detach()
+struct AdoptRef {};
+inline constexpr AdoptRef kAdoptRef{};
+
 template <typename T>
 class IntrusivePtr {
     template <typename Y>
@@ -73,15 +256,13 @@ class IntrusivePtr {
 
 public:
     // Constructors
-    IntrusivePtr() {
-        IncreaseCount();
-    };
-    IntrusivePtr(std::nullptr_t) {
-        IncreaseCount();
-    };
+    IntrusivePtr(){};
+    IntrusivePtr(std::nullptr_t){};
     IntrusivePtr(T* ptr) : ptr_(ptr) {
         IncreaseCount();
     };
+    // No IncRef: the reference held by the caller moves into this pointer
+    IntrusivePtr(T* ptr, AdoptRef) : ptr_(ptr){};
 
     template <typename Y>
     IntrusivePtr(const IntrusivePtr<Y>& other) : ptr_(other.Get()) {
@@ -89,14 +270,14 @@ public:
     };
 
     template <typename Y>
-    IntrusivePtr(IntrusivePtr<Y>&& other) : ptr_(other.Get()) {
+    IntrusivePtr(IntrusivePtr<Y>&& other) noexcept : ptr_(other.Get()) {
         other.ptr_ = nullptr;
     };
 
     IntrusivePtr(const IntrusivePtr& other) : ptr_(other.Get()) {
         IncreaseCount();
     };
-    IntrusivePtr(IntrusivePtr&& other) : ptr_(other.Get()) {
+    IntrusivePtr(IntrusivePtr&& other) noexcept : ptr_(other.Get()) {
         other.ptr_ = nullptr;
     };
 
@@ -113,7 +294,7 @@ public:
 
         return *this;
     };
-    IntrusivePtr& operator=(IntrusivePtr&& other) {
+    IntrusivePtr& operator=(IntrusivePtr&& other) noexcept {
         if (&other == this) {
             return *this;
         }
@@ -133,8 +314,7 @@ public:
 
     // Modifiers
     void Reset() {
-        DecreaseCount();
-        ptr_ = nullptr;
+        DeletePtr();
     };
     void Reset(T* ptr) {
         Reset();
@@ -144,6 +324,10 @@ public:
     void Swap(IntrusivePtr& other) {
         std::swap(other.ptr_, ptr_);
     };
+    // Gives up ownership without DecRef. Hand the result back with IntrusivePtr(ptr, kAdoptRef).
+    T* Detach() {
+        return std::exchange(ptr_, nullptr);
+    };
 
     // Observers
     T* Get() const {
@@ -181,20 +365,145 @@ private:
             ptr_->IncRef();
         }
     }
-
-    void DecreaseCount() {
-        if (ptr_) {
-            size_t prev_count = UseCount();
-            ptr_->DecRef();
-
-            if (prev_count == 1) {
-                ptr_ = nullptr;
-            }
-        }
-    }
 };
 
+template <typename T>
+struct IsTriviallyRelocatable<IntrusivePtr<T>> : std::true_type {};
+
 template <typename T, typename... Args>
 IntrusivePtr<T> MakeIntrusive(Args&&... args) {
     return IntrusivePtr<T>(new T(std::forward<Args>(args)...));
 }
+
+namespace intrusive_detail {
+
+// Whether T's reference count hands it back to the ObjectPool: only then may it come from one
+template <typename T, typename Counter>
+std::true_type IsPooled(const RefCounted<T, Counter, PooledDelete>*);
+template <typename T>
+std::true_type IsPooled(const WeakRefCounted<T, PooledDelete>*);
+template <typename T>
+std::false_type IsPooled(const void*);
+
+}  // namespace intrusive_detail
+
+// MakeIntrusive for objects released by PooledDelete
+template <typename T, typename... Args>
+IntrusivePtr<T> MakeIntrusivePooled(Args&&... args) {
+    static_assert(decltype(intrusive_detail::IsPooled<T>(static_cast<T*>(nullptr)))::value,
+                  "MakeIntrusivePooled<T> needs T to derive from RefCounted<T, ..., PooledDelete> "
+                  "or WeakRefCounted<T, PooledDelete>");
+    using Pool = ObjectPool<sizeof(T), alignof(T)>;
+    void* memory = Pool::Allocate();
+    try {
+        return IntrusivePtr<T>(::new (memory) T(std::forward<Args>(args)...));
+    } catch (...) {
+        Pool::Free(memory);
+        throw;
+    }
+}
+
+// Non-owning observer of an object derived from WeakRefCounted
+template <typename T>
+class IntrusiveWeakPtr {
+public:
+    // Constructors
+    IntrusiveWeakPtr(){};
+    IntrusiveWeakPtr(std::nullptr_t){};
+    IntrusiveWeakPtr(const IntrusivePtr<T>& other)
+        : block_(other ? other->WeakBlock() : nullptr), ptr_(other.Get()) {
+        if (block_) {
+            SMART_POINTERS_RECORD(instrument_detail::kTypeInfo<T>, kWeakInc);
+            block_->IncWeak();
+        }
+    };
+
+    IntrusiveWeakPtr(const IntrusiveWeakPtr& other) : block_(other.block_), ptr_(other.ptr_) {
+        if (block_) {
+            SMART_POINTERS_RECORD(instrument_detail::kTypeInfo<T>, kWeakInc);
+            block_->IncWeak();
+        }
+    };
+    IntrusiveWeakPtr(IntrusiveWeakPtr&& other) noexcept
+        : block_(std::exchange(other.block_, nullptr)), ptr_(std::exchange(other.ptr_, nullptr)){};
+
+    // `operator=`-s
+    IntrusiveWeakPtr& operator=(const IntrusiveWeakPtr& other) {
+        if (&other == this) {
+            return *this;
+        }
+
+        Reset();
+        block_ = other.block_;
+        ptr_ = other.ptr_;
+        if (block_) {
+            SMART_POINTERS_RECORD(instrument_detail::kTypeInfo<T>, kWeakInc);
+            block_->IncWeak();
+        }
+
+        return *this;
+    };
+    IntrusiveWeakPtr& operator=(IntrusiveWeakPtr&& other) noexcept {
+        if (&other == this) {
+            return *this;
+        }
+
+        Reset();
+        block_ = std::exchange(other.block_, nullptr);
+        ptr_ = std::exchange(other.ptr_, nullptr);
+
+        return *this;
+    };
+
+    // Destructor
+    ~IntrusiveWeakPtr() {
+        Reset();
+    };
+
+    // Modifiers
+    void Reset() {
+        if (block_) {
+            SMART_POINTERS_RECORD(instrument_detail::kTypeInfo<T>, kWeakDec);
+            if (block_->ReleaseWeak()) {
+                SMART_POINTERS_RECORD(instrument_detail::kTypeInfo<T>, kBlockFree);
+            }
+            block_ = nullptr;
+        }
+        ptr_ = nullptr;
+    };
+    void Swap(IntrusiveWeakPtr& other) {
+        std::swap(other.block_, block_);
+        std::swap(other.ptr_, ptr_);
+    };
+
+    // Observers
+    size_t UseCount() const {
+        if (block_) {
+            return block_->strong.load(std::memory_order_relaxed);
+        }
+
+        return 0;
+    };
+    bool Expired() const {
+        return UseCount() == 0;
+    };
+    // Empty if the object is already gone, never throws
+    IntrusivePtr<T> Lock() const noexcept {
+        if (block_ && block_->IncStrongIfNonZero()) {
+            SMART_POINTERS_RECORD(instrument_detail::kTypeInfo<T>, kStrongInc);
+            return IntrusivePtr<T>(ptr_, kAdoptRef);
+        }
+
+        if (block_) {
+            SMART_POINTERS_RECORD(instrument_detail::kTypeInfo<T>, kLockFailure);
+        }
+        return IntrusivePtr<T>();
+    };
+
+private:
+    IntrusiveSideBlock* block_ = nullptr;
+    T* ptr_ = nullptr;
+};
+
+template <typename T>
+struct IsTriviallyRelocatable<IntrusiveWeakPtr<T>> : std::true_type {};
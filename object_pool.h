@@ -0,0 +1,175 @@
+#pragma once
+
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <vector>
+
+// Per-thread recycling of fixed-size slots, for objects that are created and dropped at a high
+// rate (see PooledDelete / MakeIntrusivePooled in intrusive.h).
+//
+// Each thread keeps a plain free list of at most 2 * kBatch slots. A slot may be freed on any
+// thread: it simply joins that thread's list. When a list overflows, kBatch slots move to a global
+// depot, from which threads with an empty list take a whole batch under one lock. So a consumer
+// thread that frees what a producer allocates feeds the producer in batches, and neither the
+// lists nor the depot (kMaxDepotBytes) grow without bound: past that, slots go back to the heap.
+// Slots allocated or freed after the thread's list is gone (from another thread_local's destructor)
+// go through a list in the depot instead.
+template <size_t Size, size_t Align>
+class ObjectPool {
+public:
+    static constexpr size_t kBatch = 256;
+    static constexpr size_t kSlotSize = Size < sizeof(void*) ? sizeof(void*) : Size;
+    // The depot keeps at most this much idle memory.
+    static constexpr size_t kMaxDepotBytes = size_t(16) << 20;
+    static constexpr size_t kMaxBatches =
+        kMaxDepotBytes / (kBatch * kSlotSize) ? kMaxDepotBytes / (kBatch * kSlotSize) : 1;
+
+    static void* Allocate() {
+        LocalCache* cache = Local();
+        if (cache == nullptr) {
+            return AllocateShared();
+        }
+        if (cache->head == nullptr && !TakeBatch(*cache)) {
+            return ::operator new(kSlotSize, std::align_val_t(Align));
+        }
+
+        FreeSlot* slot = cache->head;
+        cache->head = slot->next;
+        --cache->count;
+        return slot;
+    }
+
+    static void Free(void* ptr) {
+        LocalCache* cache = Local();
+        if (cache == nullptr) {
+            FreeShared(ptr);
+            return;
+        }
+        auto* slot = static_cast<FreeSlot*>(ptr);
+        slot->next = cache->head;
+        cache->head = slot;
+        if (++cache->count > 2 * kBatch) {
+            GiveBatch(*cache);
+        }
+    }
+
+private:
+    struct FreeSlot {
+        FreeSlot* next;
+    };
+
+    struct LocalCache {
+        ~LocalCache() {
+            destroyed_ = true;
+            while (count >= kBatch) {
+                GiveBatch(*this);
+            }
+            ReleaseList(head);
+        }
+
+        FreeSlot* head = nullptr;
+        size_t count = 0;
+    };
+
+    struct Depot {
+        std::mutex mutex;
+        std::vector<FreeSlot*> batches;  // heads of kBatch-long lists
+        FreeSlot* loose = nullptr;       // freed after their thread's list was destroyed
+        size_t loose_count = 0;
+    };
+
+    // Null once the thread's list is destroyed
+    static LocalCache* Local() {
+        if (destroyed_) {
+            return nullptr;
+        }
+        static thread_local LocalCache cache;
+        return &cache;
+    }
+
+    // Never destroyed: thread caches flush into it during static destruction.
+    static Depot& GlobalDepot() {
+        static auto* depot = new Depot();
+        return *depot;
+    }
+
+    static bool TakeBatch(LocalCache& cache) {
+        Depot& depot = GlobalDepot();
+        std::lock_guard guard(depot.mutex);
+        if (depot.batches.empty()) {
+            return false;
+        }
+        cache.head = depot.batches.back();
+        cache.count = kBatch;
+        depot.batches.pop_back();
+        return true;
+    }
+
+    // Moves the first kBatch slots of the local list to the depot, or to the heap if it is full.
+    static void GiveBatch(LocalCache& cache) {
+        FreeSlot* batch = cache.head;
+        FreeSlot* last = batch;
+        for (size_t i = 1; i < kBatch; ++i) {
+            last = last->next;
+        }
+        cache.head = last->next;
+        cache.count -= kBatch;
+        last->next = nullptr;
+
+        Depot& depot = GlobalDepot();
+        {
+            std::lock_guard guard(depot.mutex);
+            if (depot.batches.size() < kMaxBatches) {
+                depot.batches.push_back(batch);
+                return;
+            }
+        }
+        ReleaseList(batch);
+    }
+
+    static void* AllocateShared() {
+        Depot& depot = GlobalDepot();
+        {
+            std::lock_guard guard(depot.mutex);
+            if (FreeSlot* slot = depot.loose) {
+                depot.loose = slot->next;
+                --depot.loose_count;
+                return slot;
+            }
+        }
+        return ::operator new(kSlotSize, std::align_val_t(Align));
+    }
+
+    // The loose list becomes a batch once it is kBatch long
+    static void FreeShared(void* ptr) {
+        auto* slot = static_cast<FreeSlot*>(ptr);
+        Depot& depot = GlobalDepot();
+        FreeSlot* released = nullptr;
+        {
+            std::lock_guard guard(depot.mutex);
+            slot->next = depot.loose;
+            depot.loose = slot;
+            if (++depot.loose_count == kBatch) {
+                if (depot.batches.size() < kMaxBatches) {
+                    depot.batches.push_back(depot.loose);
+                } else {
+                    released = depot.loose;
+                }
+                depot.loose = nullptr;
+                depot.loose_count = 0;
+            }
+        }
+        ReleaseList(released);
+    }
+
+    static void ReleaseList(FreeSlot* slot) {
+        while (slot) {
+            FreeSlot* next = slot->next;
+            ::operator delete(slot, std::align_val_t(Align));
+            slot = next;
+        }
+    }
+
+    static inline thread_local bool destroyed_ = false;
+};
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstddef>  // std::nullptr_t, std::ptrdiff_t
+#include <cstdint>
+#include <type_traits>
+
+// Non-owning pointer that stores the distance from itself to the pointee instead of an address.
+// Inside a memory segment mapped at different addresses by different processes, an OffsetPtr
+// to another object in the same segment means the same thing in every one of them.
+//
+// Copying recomputes the distance, so an OffsetPtr is not trivially relocatable (nor trivially
+// copyable): a memcpy'd one points somewhere else.
+template <typename T>
+class OffsetPtr {
+public:
+    using ElementType = T;
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    OffsetPtr(){};
+    OffsetPtr(std::nullptr_t){};
+    OffsetPtr(T* ptr) {
+        Set(ptr);
+    };
+
+    OffsetPtr(const OffsetPtr& other) {
+        Set(other.Get());
+    };
+    template <typename Y, typename = std::enable_if_t<std::is_convertible_v<Y*, T*>>>
+    OffsetPtr(const OffsetPtr<Y>& other) {
+        Set(other.Get());
+    };
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // `operator=`-s
+
+    OffsetPtr& operator=(const OffsetPtr& other) {
+        Set(other.Get());
+        return *this;
+    };
+    OffsetPtr& operator=(T* ptr) {
+        Set(ptr);
+        return *this;
+    };
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    T* Get() const {
+        if (offset_ == kNull) {
+            return nullptr;
+        }
+        return reinterpret_cast<T*>(Self() + static_cast<uintptr_t>(offset_));
+    };
+    T& operator*() const {
+        return *Get();
+    };
+    T* operator->() const {
+        return Get();
+    };
+    T& operator[](std::ptrdiff_t index) const {
+        return Get()[index];
+    };
+    explicit operator bool() const {
+        return offset_ != kNull;
+    };
+
+private:
+    // No object can start one byte past the OffsetPtr, inside it
+    static constexpr intptr_t kNull = 1;
+
+    intptr_t offset_ = kNull;
+
+    uintptr_t Self() const {
+        return reinterpret_cast<uintptr_t>(this);
+    }
+    void Set(T* ptr) {
+        offset_ = ptr ? static_cast<intptr_t>(reinterpret_cast<uintptr_t>(ptr) - Self()) : kNull;
+    }
+};
+
+template <typename T, typename U>
+inline bool operator==(const OffsetPtr<T>& left, const OffsetPtr<U>& right) {
+    return left.Get() == right.Get();
+};
+template <typename T, typename U>
+inline bool operator!=(const OffsetPtr<T>& left, const OffsetPtr<U>& right) {
+    return left.Get() != right.Get();
+};
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <type_traits>
+
+// A type is trivially relocatable when moving an object to a new address and ending the old
+// one's lifetime is the same as copying its bytes: nothing points back at the object itself.
+// Containers that know this (see RelocatingVector) can grow with memcpy / realloc / mremap
+// instead of a move and a destructor call per element.
+//
+// Trivially copyable types are relocatable. Others opt in by specializing the trait next to
+// their definition, as the smart pointers in this directory do.
+template <typename T>
+struct IsTriviallyRelocatable : std::bool_constant<std::is_trivially_copyable_v<T>> {};
+
+template <typename T>
+inline constexpr bool kIsTriviallyRelocatable = IsTriviallyRelocatable<T>::value;
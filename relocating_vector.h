@@ -0,0 +1,237 @@
+#pragma once
+
+#include "relocatable.h"
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+// Growable array that relocates trivially relocatable elements as bytes. Small buffers live on
+// the heap and grow with realloc; from kMapThreshold on, a buffer is its own mapping and grows
+// with mremap, which moves page table entries instead of copying (Linux only, elsewhere realloc
+// keeps going). Elements that are not trivially relocatable are moved one by one, as in
+// std::vector.
+template <typename T>
+class RelocatingVector {
+    static_assert(alignof(T) <= alignof(std::max_align_t),
+                  "RelocatingVector storage is only max_align_t aligned");
+
+public:
+    static constexpr size_t kPageSize = 4096;
+#if defined(__linux__)
+    static constexpr size_t kMapThreshold = size_t(1) << 20;
+#else
+    static constexpr size_t kMapThreshold = SIZE_MAX;
+#endif
+
+    RelocatingVector() = default;
+
+    RelocatingVector(const RelocatingVector&) = delete;
+    RelocatingVector& operator=(const RelocatingVector&) = delete;
+
+    RelocatingVector(RelocatingVector&& other) noexcept
+        : data_(std::exchange(other.data_, nullptr)),
+          size_(std::exchange(other.size_, 0)),
+          capacity_(std::exchange(other.capacity_, 0)){};
+
+    RelocatingVector& operator=(RelocatingVector&& other) noexcept {
+        if (&other != this) {
+            Destroy();
+            data_ = std::exchange(other.data_, nullptr);
+            size_ = std::exchange(other.size_, 0);
+            capacity_ = std::exchange(other.capacity_, 0);
+        }
+        return *this;
+    };
+
+    ~RelocatingVector() {
+        Destroy();
+    };
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Modifiers
+
+    template <typename... Args>
+    T& EmplaceBack(Args&&... args) {
+        if (size_ == capacity_) {
+            // The arguments may refer to an element, which growing would move away.
+            T value(std::forward<Args>(args)...);
+            Grow(size_ + 1);
+            return *::new (data_ + size_++) T(std::move(value));
+        }
+        return *::new (data_ + size_++) T(std::forward<Args>(args)...);
+    };
+    void PushBack(const T& value) {
+        EmplaceBack(value);
+    };
+    void PushBack(T&& value) {
+        EmplaceBack(std::move(value));
+    };
+    void PopBack() {
+        data_[--size_].~T();
+    };
+    void Clear() {
+        std::destroy_n(data_, size_);
+        size_ = 0;
+    };
+    void Reserve(size_t capacity) {
+        if (capacity > capacity_) {
+            Reallocate(capacity);
+        }
+    };
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    size_t Size() const {
+        return size_;
+    };
+    size_t Capacity() const {
+        return capacity_;
+    };
+    bool Empty() const {
+        return size_ == 0;
+    };
+    T* Data() const {
+        return data_;
+    };
+
+    T& operator[](size_t idx) const {
+        return data_[idx];
+    };
+
+    T* begin() const {
+        return data_;
+    };
+    T* end() const {
+        return data_ + size_;
+    };
+
+private:
+    // Doubles, but at least to `needed` and to a whole page once the buffer is mapped.
+    void Grow(size_t needed) {
+        size_t capacity = capacity_ ? capacity_ * 2 : 16;
+        if (capacity < needed) {
+            capacity = needed;
+        }
+        Reallocate(capacity);
+    }
+
+    void Reallocate(size_t capacity) {
+        if (capacity > SIZE_MAX / sizeof(T)) {
+            throw std::bad_array_new_length();
+        }
+        size_t bytes = StorageBytes(capacity);
+        if (bytes >= kMapThreshold) {
+            capacity = bytes / sizeof(T);
+        }
+
+        if constexpr (kIsTriviallyRelocatable<T>) {
+            data_ = static_cast<T*>(ResizeStorage(data_, StorageBytes(capacity_), bytes));
+        } else {
+            T* fresh = static_cast<T*>(AllocateStorage(bytes));
+            // Like std::vector: copy instead of move if a throwing move could lose elements.
+            try {
+                if constexpr (std::is_nothrow_move_constructible_v<T> ||
+                              !std::is_copy_constructible_v<T>) {
+                    std::uninitialized_move_n(data_, size_, fresh);
+                } else {
+                    std::uninitialized_copy_n(data_, size_, fresh);
+                }
+            } catch (...) {
+                FreeStorage(fresh, bytes);
+                throw;
+            }
+            std::destroy_n(data_, size_);
+            FreeStorage(data_, StorageBytes(capacity_));
+            data_ = fresh;
+        }
+        capacity_ = capacity;
+    }
+
+    void Destroy() {
+        if (data_) {
+            std::destroy_n(data_, size_);
+            FreeStorage(data_, StorageBytes(capacity_));
+        }
+    }
+
+    // Mapped buffers are whole pages, so a mapping's size follows from the capacity.
+    static size_t StorageBytes(size_t capacity) {
+        size_t bytes = capacity * sizeof(T);
+        if (bytes >= kMapThreshold) {
+            bytes = (bytes + kPageSize - 1) / kPageSize * kPageSize;
+        }
+        return bytes;
+    }
+
+    static void* AllocateStorage(size_t bytes) {
+        void* memory;
+#if defined(__linux__)
+        if (bytes >= kMapThreshold) {
+            memory =
+                mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (memory == MAP_FAILED) {
+                throw std::bad_alloc();
+            }
+            return memory;
+        }
+#endif
+        memory = std::malloc(bytes);
+        if (memory == nullptr) {
+            throw std::bad_alloc();
+        }
+        return memory;
+    }
+
+    static void FreeStorage(void* memory, size_t bytes) {
+#if defined(__linux__)
+        if (bytes >= kMapThreshold) {
+            munmap(memory, bytes);
+            return;
+        }
+#endif
+        std::free(memory);
+    }
+
+    // Grows the buffer, keeping its first `old_bytes` bytes.
+    static void* ResizeStorage(void* memory, size_t old_bytes, size_t bytes) {
+#if defined(__linux__)
+        if (old_bytes >= kMapThreshold) {
+            void* moved = mremap(memory, old_bytes, bytes, MREMAP_MAYMOVE);
+            if (moved == MAP_FAILED) {
+                throw std::bad_alloc();
+            }
+            return moved;
+        }
+        if (bytes >= kMapThreshold) {
+            void* mapped = AllocateStorage(bytes);
+            if (memory) {
+                std::memcpy(mapped, memory, old_bytes);
+                std::free(memory);
+            }
+            return mapped;
+        }
+#endif
+        void* resized = std::realloc(memory, bytes);
+        if (resized == nullptr) {
+            throw std::bad_alloc();
+        }
+        return resized;
+    }
+
+    T* data_ = nullptr;
+    size_t size_ = 0;
+    size_t capacity_ = 0;
+};
+
+template <typename T>
+struct IsTriviallyRelocatable<RelocatingVector<T>> : std::true_type {};
@@ -1,107 +1,93 @@
 #pragma once
 
 #include "sw_fwd.h"  // Forward declaration
+#include "weak.h"    // EnableSharedFromThis keeps a WeakPtr inline
 
 #include <stdio.h>
 #include <cstddef>  // std::nullptr_t
 
 // https://en.cppreference.com/w/cpp/memory/shared_ptr
+// SharedPtr<T[]> and SharedPtr<T[N]> are made by MakeShared / MakeSharedForOverwrite.
 template <typename T>
 class SharedPtr {
 public:
+    using ElementType = std::remove_extent_t<T>;
+
     ////////////////////////////////////////////////////////////////////////////////////////////////
     // Constructors
 
-    SharedPtr() {
-        if constexpr (std::is_convertible_v<T*, ESFTBase*>) {
-            InitWeakThis(ptr_);
-        }
-    };
+    SharedPtr(){};
     SharedPtr(std::nullptr_t){};
-    explicit SharedPtr(T* ptr) : block_(new ControlBlockPointer<T>(ptr)), ptr_(ptr) {
-        if constexpr (std::is_convertible_v<T*, ESFTBase*>) {
-            InitWeakThis(ptr_);
-        }
+    explicit SharedPtr(ElementType* ptr) : block_(new ControlBlockPointer<T>(ptr)), ptr_(ptr) {
+        EnableWeakThis();
     };
     template <class Y>
     explicit SharedPtr(Y* ptr) : block_(new ControlBlockPointer<Y>(ptr)), ptr_(ptr) {
-        if constexpr (std::is_convertible_v<T*, ESFTBase*>) {
-            InitWeakThis(ptr_);
-        }
+        EnableWeakThis();
     };
-    SharedPtr(ControlBlockBase* block, T* ptr) : block_(block), ptr_(ptr) {
-        if constexpr (std::is_convertible_v<T*, ESFTBase*>) {
-            InitWeakThis(ptr_);
-        }
+    template <typename Y, typename Deleter,
+              typename = std::enable_if_t<std::is_invocable_v<Deleter&, Y*>>>
+    SharedPtr(Y* ptr, Deleter deleter)
+        : block_(MakeDeleterBlock(ptr, std::move(deleter))), ptr_(ptr) {
+        EnableWeakThis();
+    };
+    template <typename Y, typename Deleter, typename Alloc,
+              typename = std::enable_if_t<std::is_invocable_v<Deleter&, Y*>>>
+    SharedPtr(Y* ptr, Deleter deleter, const Alloc& alloc)
+        : block_(MakeDeleterBlock(ptr, std::move(deleter), alloc)), ptr_(ptr) {
+        EnableWeakThis();
+    };
+    // Takes over the pointer and the deleter, the only allocation is the control block
+    template <typename Y, typename Deleter>
+    SharedPtr(UniquePtr<Y, Deleter>&& other)
+        : block_(MakeUniqueBlock(other)), ptr_(other.Release()) {
+        EnableWeakThis();
+    };
+    // Adopts a reference the caller already holds on `block`
+    SharedPtr(ControlBlockBase* block, ElementType* ptr) : block_(block), ptr_(ptr) {
+        EnableWeakThis();
     };
 
     SharedPtr(const SharedPtr& other) : block_(other.block_), ptr_(other.ptr_) {
         if (block_) {
-            ++block_->strong_cnt;
-        }
-
-        if constexpr (std::is_convertible_v<T*, ESFTBase*>) {
-            InitWeakThis(ptr_);
+            block_->IncStrong();
         }
     };
     template <typename Another>
     SharedPtr(const SharedPtr<Another>& other) : block_(other.GetBlock()), ptr_(other.Get()) {
         if (block_) {
-            ++block_->strong_cnt;
-        }
-
-        if constexpr (std::is_convertible_v<T*, ESFTBase*>) {
-            InitWeakThis(ptr_);
+            block_->IncStrong();
         }
     };
     template <typename Another>
-    SharedPtr(SharedPtr<Another>&& other) : block_(other.GetBlock()), ptr_(other.Get()) {
+    SharedPtr(SharedPtr<Another>&& other) noexcept : block_(other.GetBlock()), ptr_(other.Get()) {
         other.CreateNullObject();
-        if constexpr (std::is_convertible_v<T*, ESFTBase*>) {
-            InitWeakThis(ptr_);
-        }
     };
-    SharedPtr(SharedPtr<T>&& other) : block_(other.block_), ptr_(other.ptr_) {
+    SharedPtr(SharedPtr<T>&& other) noexcept : block_(other.block_), ptr_(other.ptr_) {
         other.ptr_ = nullptr;
         other.block_ = nullptr;
-
-        if constexpr (std::is_convertible_v<T*, ESFTBase*>) {
-            InitWeakThis(ptr_);
-        }
     };
 
     // Aliasing constructor
     // #8 from https://en.cppreference.com/w/cpp/memory/shared_ptr/shared_ptr
     template <typename Y>
-    SharedPtr(const SharedPtr<Y>& other, T* ptr) : block_(other.GetBlock()), ptr_(ptr) {
+    SharedPtr(const SharedPtr<Y>& other, ElementType* ptr) : block_(other.GetBlock()), ptr_(ptr) {
         if (block_) {
-            ++block_->strong_cnt;
-        }
-
-        if constexpr (std::is_convertible_v<T*, ESFTBase*>) {
-            InitWeakThis(ptr_);
+            block_->IncStrong();
         }
     };
 
     // Promote `WeakPtr`
     // #11 from https://en.cppreference.com/w/cpp/memory/shared_ptr/shared_ptr
     explicit SharedPtr(const WeakPtr<T>& other) : block_(other.GetBlock()), ptr_(other.GetPtr()) {
-        if (block_) {
-            if (block_->strong_cnt == 0) {  // weak ptr is dead
-                throw BadWeakPtr();         // throw error
-            }
-
-            ++block_->strong_cnt;
+        if (block_ && !block_->IncStrongIfNonZero()) {  // weak ptr is dead
+            throw BadWeakPtr();                          // throw error
         }
     };
 
     explicit SharedPtr(WeakPtr<T>* other) : block_(other->GetBlock()), ptr_(other->GetPtr()) {
-        if (block_) {
-            if (block_->strong_cnt == 0) {  // weak ptr is dead
-                throw BadWeakPtr();         // throw error
-            }
-
-            ++block_->strong_cnt;
+        if (block_ && !block_->IncStrongIfNonZero()) {  // weak ptr is dead
+            throw BadWeakPtr();                          // throw error
         }
     };
 
@@ -118,12 +104,12 @@ public:
 
         if (other.block_) {
             block_ = other.block_;
-            ++block_->strong_cnt;
+            block_->IncStrong();
         }
 
         return *this;
     };
-    SharedPtr& operator=(SharedPtr&& other) {
+    SharedPtr& operator=(SharedPtr&& other) noexcept {
         if (&other == this) {
             return *this;
         }
@@ -149,11 +135,12 @@ public:
     void Reset() {
         DeleteBlock();
     };
-    void Reset(T* ptr) {
+    void Reset(ElementType* ptr) {
         DeleteBlock();
 
         ptr_ = ptr;
         block_ = new ControlBlockPointer<T>(ptr);
+        EnableWeakThis();
     };
     template <typename Y>
     void Reset(Y* ptr) {
@@ -161,6 +148,15 @@ public:
 
         ptr_ = ptr;
         block_ = new ControlBlockPointer<Y>(ptr);
+        EnableWeakThis();
+    };
+    template <typename Y, typename Deleter>
+    void Reset(Y* ptr, Deleter deleter) {
+        DeleteBlock();
+
+        block_ = MakeDeleterBlock(ptr, std::move(deleter));
+        ptr_ = ptr;
+        EnableWeakThis();
     };
     void Swap(SharedPtr& other) {
         std::swap(other.block_, block_);
@@ -177,18 +173,30 @@ public:
         ptr_ = nullptr;
     }
 
-    T* Get() const {
+    ElementType* Get() const {
         return ptr_;
     };
-    T& operator*() const {
+    ElementType& operator*() const {
         return *ptr_;
     };
-    T* operator->() const {
+    ElementType* operator->() const {
         return Get();
     };
+    ElementType& operator[](std::ptrdiff_t index) const {
+        return ptr_[index];
+    };
+    // Number of elements of SharedPtr<T[]> / SharedPtr<T[N]>
+    size_t Size() const {
+        static_assert(std::is_array_v<T>, "Size() is only there for arrays");
+        if constexpr (std::extent_v<T> != 0) {
+            return std::extent_v<T>;
+        } else {
+            return ptr_ ? ControlBlockEmplace<std::remove_cv_t<ElementType>[]>::Size(ptr_) : 0;
+        }
+    };
     size_t UseCount() const {
         if (block_) {
-            return block_->strong_cnt;
+            return block_->StrongCount();
         } else {
             return 0;
         }
@@ -202,41 +210,134 @@ public:
     };
 
 private:
+    template <typename U>
+    friend class WeakPtr;
+
+    // Adopts the reference WeakPtr::Lock just took. The object has an owner already, so there is
+    // no weak `this` to set up.
+    struct Locked {};
+    SharedPtr(ControlBlockBase* block, ElementType* ptr, Locked) : block_(block), ptr_(ptr){};
+
     ControlBlockBase* block_ = nullptr;
-    T* ptr_ = nullptr;
+    ElementType* ptr_ = nullptr;
 
     void DeleteBlock() {
         if (block_) {
-            --block_->strong_cnt;
-
-            if (block_->strong_cnt == 0) {
-                size_t prev_count = block_->weak_cnt;
-                block_->ClearPtr();
-
-                if (prev_count == 0) {
-                    delete block_;
-                }
-            }
-
+            block_->ReleaseStrong();
             block_ = nullptr;
         }
         ptr_ = nullptr;
     }
 
+    // If the block cannot be allocated the pointer is still released through `deleter`
+    template <typename Y, typename Deleter>
+    static ControlBlockBase* MakeDeleterBlock(Y* ptr, Deleter deleter) {
+        static_assert(std::extent_v<T> != 0 || !std::is_array_v<T>,
+                      "SharedPtr<T[]> needs the element count only MakeShared<T[]> keeps");
+        try {
+            return new ControlBlockDeleter<Y, Deleter>(ptr, deleter);
+        } catch (...) {
+            deleter(ptr);
+            throw;
+        }
+    }
+    // Moves the deleter in, and leaves `unique` owning the object if the block cannot be allocated
+    template <typename Y, typename Deleter>
+    static ControlBlockBase* MakeUniqueBlock(UniquePtr<Y, Deleter>& unique) {
+        static_assert(std::extent_v<T> != 0 || !std::is_array_v<T>,
+                      "SharedPtr<T[]> needs the element count only MakeShared<T[]> keeps");
+        auto* ptr = unique.Get();
+        if (!ptr) {
+            return nullptr;
+        }
+        return new ControlBlockDeleter<std::remove_pointer_t<decltype(ptr)>, Deleter>(
+            ptr, std::move(unique.GetDeleter()));
+    }
+    template <typename Y, typename Deleter, typename Alloc>
+    static ControlBlockBase* MakeDeleterBlock(Y* ptr, Deleter deleter, const Alloc& alloc) {
+        static_assert(std::extent_v<T> != 0 || !std::is_array_v<T>,
+                      "SharedPtr<T[]> needs the element count only MakeShared<T[]> keeps");
+        try {
+            return ControlBlockAllocated<ControlBlockDeleter<Y, Deleter>, Alloc>::Create(
+                alloc, ptr, deleter);
+        } catch (...) {
+            deleter(ptr);
+            throw;
+        }
+    }
+
+    // Called by the constructors that create a control block: points the object's inline weak
+    // reference at it, unless another live block already owns the object.
+    void EnableWeakThis() {
+        if constexpr (std::is_convertible_v<T*, const ESFTBase*>) {
+            if (ptr_) {
+                InitWeakThis(ptr_);
+            }
+        }
+    }
     template <typename Y>
-    void InitWeakThis(EnableSharedFromThis<Y>* e) {
-        auto temp = new WeakPtr<Y>(this);
-        e->weak_this_ = temp;
+    void InitWeakThis(const EnableSharedFromThis<Y>* e) {
+        if (e->weak_this_.Expired()) {
+            e->weak_this_ = SharedPtr<Y>(*this, const_cast<Y*>(static_cast<const Y*>(ptr_)));
+        }
     }
 };
 
 // Allocate memory only once
+// MakeShared<T, CountPolicy::kSingleThreaded>(...) skips atomic counting for thread-local objects
+template <typename T, CountPolicy Policy = CountPolicy::kAtomic, typename... Args>
+std::enable_if_t<!std::is_array_v<T>, SharedPtr<T>> MakeShared(Args&&... args) {
+    auto block = new ControlBlockEmplace<T, ControlBlockBaseFor<Policy>>(
+        Policy, std::forward<Args>(args)...);
+    return SharedPtr<T>(block, block->GetPtr());
+};
+
+// MakeShared<T, CountPolicy::kSharded>: the count is striped over per-thread cache lines, see
+// ShardedControlBlockBase. Worth its 4 KiB block only for objects every core copies all the time.
 template <typename T, typename... Args>
-SharedPtr<T> MakeShared(Args&&... args) {
-    auto block = new ControlBlockEmplace<T>(std::forward<Args>(args)...);
+SharedPtr<T> MakeSharedSharded(Args&&... args) {
+    return MakeShared<T, CountPolicy::kSharded>(std::forward<Args>(args)...);
+};
+
+// MakeShared with the block placed by `alloc` instead of the control block pool
+template <typename T, CountPolicy Policy = CountPolicy::kAtomic, typename Alloc, typename... Args>
+SharedPtr<T> AllocateShared(const Alloc& alloc, Args&&... args) {
+    using Block = ControlBlockEmplace<T, ControlBlockBaseFor<Policy>>;
+    auto block = ControlBlockAllocated<Block, Alloc>::Create(alloc, Policy,
+                                                             std::forward<Args>(args)...);
     return SharedPtr<T>(block, block->GetPtr());
 };
 
+// Arrays: the block and the elements share one allocation, see ControlBlockEmplace<T[]>
+template <typename T, CountPolicy Policy = CountPolicy::kAtomic>
+SharedPtr<T> MakeSharedArray(size_t size, bool value_init) {
+    using Block = ControlBlockEmplace<std::remove_extent_t<T>[], ControlBlockBaseFor<Policy>>;
+    auto block = Block::Create(Policy, size, value_init);
+    return SharedPtr<T>(block, block->GetPtr());
+};
+
+// `size` value-initialized elements
+template <typename T, CountPolicy Policy = CountPolicy::kAtomic>
+std::enable_if_t<std::is_array_v<T> && std::extent_v<T> == 0, SharedPtr<T>> MakeShared(
+    size_t size) {
+    return MakeSharedArray<T, Policy>(size, true);
+};
+template <typename T, CountPolicy Policy = CountPolicy::kAtomic>
+std::enable_if_t<std::extent_v<T> != 0, SharedPtr<T>> MakeShared() {
+    return MakeSharedArray<T, Policy>(std::extent_v<T>, true);
+};
+
+// Default-initialized elements: trivial ones are not zeroed, for buffers that get overwritten
+template <typename T, CountPolicy Policy = CountPolicy::kAtomic>
+std::enable_if_t<std::is_array_v<T> && std::extent_v<T> == 0, SharedPtr<T>> MakeSharedForOverwrite(
+    size_t size) {
+    return MakeSharedArray<T, Policy>(size, false);
+};
+template <typename T, CountPolicy Policy = CountPolicy::kAtomic>
+std::enable_if_t<std::extent_v<T> != 0, SharedPtr<T>> MakeSharedForOverwrite() {
+    return MakeSharedArray<T, Policy>(std::extent_v<T>, false);
+};
+
 template <typename T, typename U>
 inline bool operator==(const SharedPtr<T>& left, const SharedPtr<U>& right) {
     return left.GetBlock() == right.GetBlock();
@@ -0,0 +1,330 @@
+#pragma once
+
+#include "relocating_vector.h"
+#include "shared.h"
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+#include <sys/uio.h>
+
+// Reference-counted bytes for pipelines that split and forward buffers instead of copying them.
+//
+// A SharedBuffer is a window into an allocation made by MakeSharedForOverwrite<std::byte[]> (or
+// MakeShared for small ones), so the control block and the bytes are one allocation. The
+// window's pointer is an aliasing SharedPtr, and Slice / TakePrefix hand out more windows into
+// the same allocation in O(1).
+// Writing goes through MutableData, which copies the window out first unless nothing else
+// shares the allocation. A SharedBufferChain strings windows together for writev.
+
+class SharedBuffer {
+public:
+    static constexpr size_t kToEnd = SIZE_MAX;
+    // Up to this size the block and the bytes fit one 64-byte control block pool slot, instead of
+    // the cache-line aligned array allocation: rewritten headers, small messages.
+    static constexpr size_t kSmallSize = 48;
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    SharedBuffer(){};
+
+    // `size` bytes, not initialized
+    explicit SharedBuffer(size_t size) {
+        if (size == 0) {
+            return;
+        } else if (size <= kSmallSize) {
+            SharedPtr<SmallBytes> small = MakeShared<SmallBytes>();
+            std::byte* bytes = small->bytes;
+            Adopt(std::move(small), bytes, size);
+        } else {
+            SharedPtr<std::byte[]> whole = MakeSharedForOverwrite<std::byte[]>(size);
+            std::byte* bytes = whole.Get();
+            Adopt(std::move(whole), bytes, size);
+        }
+    };
+
+    SharedBuffer(const void* data, size_t size) : SharedBuffer(size) {
+        if (size != 0) {
+            std::memcpy(data_.Get(), data, size);
+        }
+    };
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Slicing, all O(1) and sharing the allocation
+
+    // Throws std::out_of_range if `offset` is past the end, `size` is clamped to it
+    SharedBuffer Slice(size_t offset, size_t size = kToEnd) const {
+        if (offset > size_) {
+            throw std::out_of_range("SharedBuffer::Slice offset past the end");
+        }
+        size = std::min(size, size_ - offset);
+        if (size == 0) {
+            return SharedBuffer();
+        }
+        return SharedBuffer(SharedPtr<std::byte>(data_, data_.Get() + offset), size);
+    };
+
+    // Splits the first `size` bytes off into a buffer of their own
+    SharedBuffer TakePrefix(size_t size) {
+        SharedBuffer prefix = Slice(0, size);
+        RemovePrefix(prefix.Size());
+        return prefix;
+    };
+
+    void RemovePrefix(size_t size) {
+        if (size >= size_) {
+            *this = SharedBuffer();
+            return;
+        }
+        // Moves the window's reference along instead of taking a new one
+        ControlBlockBase* block = data_.GetBlock();
+        std::byte* start = data_.Get() + size;
+        data_.CreateNullObject();
+        data_ = SharedPtr<std::byte>(block, start);
+        size_ -= size;
+    };
+    void RemoveSuffix(size_t size) {
+        if (size >= size_) {
+            *this = SharedBuffer();
+            return;
+        }
+        size_ -= size;
+    };
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Writing
+
+    // Copy-on-write: if another buffer shares the allocation, this one gets a copy of its bytes
+    // first. Invalidates pointers from earlier MutableData / Data calls in that case.
+    std::byte* MutableData() {
+        if (size_ == 0) {
+            return nullptr;
+        }
+        if (data_.UseCount() == 1) {
+            // The other owners' last reads happened before their releases
+            std::atomic_thread_fence(std::memory_order_acquire);
+            return data_.Get();
+        }
+        *this = SharedBuffer(data_.Get(), size_);
+        return data_.Get();
+    };
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    const std::byte* Data() const {
+        return data_.Get();
+    };
+    size_t Size() const {
+        return size_;
+    };
+    bool Empty() const {
+        return size_ == 0;
+    };
+    const std::byte& operator[](size_t index) const {
+        return data_.Get()[index];
+    };
+    // Buffers sharing the allocation, this one included
+    size_t UseCount() const {
+        return data_.UseCount();
+    };
+
+private:
+    struct SmallBytes {
+        SmallBytes(){};  // left uninitialized, like MakeSharedForOverwrite's bytes
+        std::byte bytes[kSmallSize];
+    };
+
+    SharedPtr<std::byte> data_;
+    size_t size_ = 0;
+
+    // Takes over whole's reference instead of copying it
+    template <typename Whole>
+    void Adopt(SharedPtr<Whole> whole, std::byte* bytes, size_t size) {
+        data_ = SharedPtr<std::byte>(whole.GetBlock(), bytes);
+        whole.CreateNullObject();
+        size_ = size;
+    }
+
+    SharedBuffer(SharedPtr<std::byte> data, size_t size) : data_(std::move(data)), size_(size){};
+};
+
+// A SharedPtr and a size
+template <>
+struct IsTriviallyRelocatable<SharedBuffer> : std::true_type {};
+
+// Buffers in order, for scatter/gather output. Move-only, like the RelocatingVector it keeps
+// them in; taking bytes off the front only advances an index, so a writev loop does not shift
+// the buffers left over. Once the used-up slots are half the vector, the rest moves down, so a
+// queue that is appended to while it drains stays within twice its buffers.
+class SharedBufferChain {
+public:
+    // writev takes at most IOV_MAX buffers per call
+    static constexpr size_t kMaxIovecs = IOV_MAX;
+
+    SharedBufferChain() = default;
+
+    SharedBufferChain(SharedBufferChain&& other) noexcept
+        : buffers_(std::move(other.buffers_)),
+          first_(std::exchange(other.first_, 0)),
+          size_(std::exchange(other.size_, 0)){};
+    SharedBufferChain& operator=(SharedBufferChain&& other) noexcept {
+        buffers_ = std::move(other.buffers_);
+        first_ = std::exchange(other.first_, 0);
+        size_ = std::exchange(other.size_, 0);
+        return *this;
+    };
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Modifiers
+
+    void Append(SharedBuffer buffer) {
+        if (!buffer.Empty()) {
+            size_ += buffer.Size();
+            buffers_.PushBack(std::move(buffer));
+        }
+    };
+    // Appending a chain to itself leaves it as it is
+    void Append(SharedBufferChain&& other) {
+        if (&other == this) {
+            return;
+        }
+        for (size_t i = other.first_, end = other.buffers_.Size(); i < end; ++i) {
+            Append(std::move(other.buffers_[i]));
+        }
+        other.Clear();
+    };
+
+    // Splits off the first `size` bytes (fewer if the chain is shorter), cutting at most one
+    // buffer in two, without copying any bytes
+    SharedBufferChain TakePrefix(size_t size) {
+        SharedBufferChain prefix;
+        while (size != 0 && first_ < buffers_.Size()) {
+            SharedBuffer& front = buffers_[first_];
+            if (front.Size() <= size) {
+                size -= front.Size();
+                size_ -= front.Size();
+                prefix.Append(std::move(front));
+                PopFront();
+            } else {
+                size_ -= size;
+                prefix.Append(front.TakePrefix(size));
+                size = 0;
+            }
+        }
+        return prefix;
+    };
+
+    // Drops the first `size` bytes, e.g. the ones a partial writev got out
+    void RemovePrefix(size_t size) {
+        while (size != 0 && first_ < buffers_.Size()) {
+            SharedBuffer& front = buffers_[first_];
+            size_t removed = std::min(size, front.Size());
+            front.RemovePrefix(removed);
+            size -= removed;
+            size_ -= removed;
+            if (front.Empty()) {
+                PopFront();
+            }
+        }
+    };
+
+    void Clear() {
+        buffers_.Clear();
+        first_ = 0;
+        size_ = 0;
+    };
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Output
+
+    // Points `out` at the first buffers, at most `max` of them, and returns how many it filled
+    size_t FillIovecs(iovec* out, size_t max) const {
+        size_t count = std::min(max, Count());
+        for (size_t i = 0; i < count; ++i) {
+            const SharedBuffer& buffer = buffers_[first_ + i];
+            out[i].iov_base = const_cast<std::byte*>(buffer.Data());
+            out[i].iov_len = buffer.Size();
+        }
+        return count;
+    };
+
+    // One writev of up to kMaxIovecs buffers. Drops what was written and returns writev's result.
+    ssize_t WriteTo(int fd) {
+        iovec iovecs[kMaxIovecs];
+        ssize_t written = writev(fd, iovecs, static_cast<int>(FillIovecs(iovecs, kMaxIovecs)));
+        if (written > 0) {
+            RemovePrefix(static_cast<size_t>(written));
+        }
+        return written;
+    };
+
+    // The bytes in one buffer: the only one as it is, otherwise a copy
+    SharedBuffer Flatten() const {
+        if (Count() == 1) {
+            return buffers_[first_];
+        }
+        SharedBuffer flat(size_);
+        std::byte* out = flat.MutableData();
+        for (size_t i = first_; i < buffers_.Size(); ++i) {
+            std::memcpy(out, buffers_[i].Data(), buffers_[i].Size());
+            out += buffers_[i].Size();
+        }
+        return flat;
+    };
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    // Bytes
+    size_t Size() const {
+        return size_;
+    };
+    // Buffers
+    size_t Count() const {
+        return buffers_.Size() - first_;
+    };
+    bool Empty() const {
+        return size_ == 0;
+    };
+    const SharedBuffer& operator[](size_t index) const {
+        return buffers_[first_ + index];
+    };
+    // Slots in the vector, the used-up ones before the first buffer included
+    size_t Slots() const {
+        return buffers_.Size();
+    };
+
+private:
+    RelocatingVector<SharedBuffer> buffers_;
+    size_t first_ = 0;  // buffers before it are used up and empty
+    size_t size_ = 0;
+
+    void PopFront() {
+        buffers_[first_++] = SharedBuffer();
+        if (first_ == buffers_.Size()) {
+            Clear();
+        } else if (2 * first_ >= buffers_.Size()) {
+            Compact();
+        }
+    }
+
+    // Moves the buffers left down to the front, at most as many moves as pops since the last time
+    void Compact() {
+        size_t count = Count();
+        for (size_t i = 0; i < count; ++i) {
+            buffers_[i] = std::move(buffers_[first_ + i]);
+        }
+        while (buffers_.Size() > count) {
+            buffers_.PopBack();
+        }
+        first_ = 0;
+    }
+};
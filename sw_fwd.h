@@ -1,8 +1,18 @@
 #pragma once
 
+#include "block_pool.h"
+#include "compressed_pair.h"
+#include "instrument.h"
+#include "relocatable.h"
+
+#include <atomic>
+#include <cstddef>  // offsetof
+#include <cstdint>
 #include <exception>
 #include <memory>
+#include <new>
 #include <stdio.h>
+#include <type_traits>
 
 class BadWeakPtr : public std::exception {};
 
@@ -12,109 +22,909 @@ class SharedPtr;
 template <typename T>
 class WeakPtr;
 
+// A block pointer and an object pointer, neither of which points back at the SharedPtr / WeakPtr
+template <typename T>
+struct IsTriviallyRelocatable<SharedPtr<T>> : std::true_type {};
+
+template <typename T>
+struct IsTriviallyRelocatable<WeakPtr<T>> : std::true_type {};
+
+template <typename T, typename Deleter>
+class UniquePtr;
+
+// How a control block counts its references. Chosen once, when the block is created,
+// and obeyed by every SharedPtr / WeakPtr that shares the block.
+enum class CountPolicy : uint8_t {
+    kAtomic,          // owners may be copied and destroyed on any thread
+    kSingleThreaded,  // plain counters, every owner must stay on the creating thread
+    kBiased,          // plain counter for the creating thread, atomic one for everybody else
+    kSharded,         // striped over per-thread slots, for a few objects every core keeps copying
+};
+
+struct BiasedControlBlockBase;
+struct ShardedControlBlockBase;
+
+inline constexpr size_t kCacheLineSize = 64;
+
+// What a control block's Manage function is asked to do.
+enum class BlockOp : uint8_t {
+    kDestroyObject,  // the last strong reference is gone
+    kFreeBlock,      // the last weak reference is gone as well
+};
+
+struct ControlBlockBase;
+
+// Static, per block type and policy. Holds the only function that knows the concrete block.
+struct BlockOps {
+    void (*manage)(ControlBlockBase*, BlockOp);
+    CountPolicy policy;
+#ifdef SMART_POINTERS_INSTRUMENT
+    instrument_detail::TypeInfo* type_info;  // what the block's events are charged to
+#endif
+};
+
+template <auto Manage, typename Pointee>
+const BlockOps* OpsFor(CountPolicy policy) {
+#ifdef SMART_POINTERS_INSTRUMENT
+    static constexpr BlockOps kTable[] = {
+        {Manage, CountPolicy::kAtomic, &instrument_detail::kTypeInfo<Pointee>},
+        {Manage, CountPolicy::kSingleThreaded, &instrument_detail::kTypeInfo<Pointee>},
+        {Manage, CountPolicy::kBiased, &instrument_detail::kTypeInfo<Pointee>},
+        {Manage, CountPolicy::kSharded, &instrument_detail::kTypeInfo<Pointee>},
+    };
+#else
+    static constexpr BlockOps kTable[] = {
+        {Manage, CountPolicy::kAtomic},
+        {Manage, CountPolicy::kSingleThreaded},
+        {Manage, CountPolicy::kBiased},
+        {Manage, CountPolicy::kSharded},
+    };
+#endif
+    return &kTable[static_cast<size_t>(policy)];
+}
+
+// 16-byte header shared by all control blocks: one 64-bit word with both counts, and a pointer
+// to the block type's static BlockOps. No vtable and no "destroyed" flag: the object is alive
+// exactly while the strong count is non-zero.
+//
+// The weak count sits in the low half of `counts` and the strong count in the high half (see
+// BiasedControlBlockBase for its kBiased meaning, kSharded blocks keep theirs elsewhere). All
+// strong owners together hold one weak reference, so the block is freed exactly once, by whoever
+// drops the weak half to zero.
+// Keeping the strong count on top means a borrow out of it falls off the word instead of
+// corrupting the weak count.
 struct ControlBlockBase {
-    ControlBlockBase(){};
-    size_t strong_cnt = 1;
-    size_t weak_cnt = 0;
+    static constexpr uint64_t kWeakOne = 1;
+    static constexpr uint64_t kWeakMask = (uint64_t(1) << 32) - 1;
+    static constexpr int kStrongShift = 32;
+    static constexpr uint64_t kStrongOne = uint64_t(1) << kStrongShift;
+
+    explicit ControlBlockBase(const BlockOps* ops) : counts(kStrongOne | kWeakOne), ops(ops){};
+
+    std::atomic<uint64_t> counts;
+    const BlockOps* ops;
+
+    // Never changes, so unlike `counts` it can be read without touching the contended word.
+    CountPolicy Policy() const {
+        return ops->policy;
+    };
+
+    void IncStrong() {
+        SMART_POINTERS_RECORD(*ops->type_info, kStrongInc);
+        CountPolicy policy = Policy();
+        if (policy == CountPolicy::kBiased) {
+            BiasedInc();
+        } else if (policy == CountPolicy::kSharded) {
+            ShardedInc();
+        } else {
+            Add(kStrongOne);
+        }
+    };
+    // Lock a weak reference: take a strong one unless the object is already gone.
+    bool IncStrongIfNonZero() {
+        bool locked = TryIncStrong();
+        if (locked) {
+            SMART_POINTERS_RECORD(*ops->type_info, kStrongInc);
+        } else {
+            SMART_POINTERS_RECORD(*ops->type_info, kLockFailure);
+        }
+        return locked;
+    };
+    void IncWeak() {
+        SMART_POINTERS_RECORD(*ops->type_info, kWeakInc);
+        Add(kWeakOne);
+    };
+
+    // Drop a strong reference, destroying the object (and maybe the block) on the last one.
+    void ReleaseStrong() {
+        SMART_POINTERS_RECORD(*ops->type_info, kStrongDec);
+        CountPolicy policy = Policy();
+        if (policy == CountPolicy::kBiased || policy == CountPolicy::kSharded) {
+            if (policy == CountPolicy::kBiased ? BiasedDec() : ShardedDec()) {
+                DestroyObject();
+            }
+            return;
+        }
+
+        if (Subtract(kStrongOne) < kStrongOne) {
+            DestroyObject();
+        }
+    };
+    // Called once the strong count is known to be gone for good.
+    void DestroyObject() {
+        SMART_POINTERS_RECORD(*ops->type_info, kObjectDestroy);
+        ops->manage(this, BlockOp::kDestroyObject);
+        DropWeak();
+    };
+    // Drop a weak reference, freeing the block on the last one.
+    void ReleaseWeak() {
+        SMART_POINTERS_RECORD(*ops->type_info, kWeakDec);
+        DropWeak();
+    };
+    // Called by every block type once its object is in place.
+    void RecordCreated() {
+        SMART_POINTERS_RECORD(*ops->type_info, kBlockAlloc);
+        SMART_POINTERS_RECORD(*ops->type_info, kObjectCreate);
+    };
+
+    size_t StrongCount() const {
+        CountPolicy policy = Policy();
+        if (policy == CountPolicy::kBiased) {
+            return BiasedCount();
+        }
+        if (policy == CountPolicy::kSharded) {
+            return ShardedCount();
+        }
+        return counts.load(std::memory_order_relaxed) >> kStrongShift;
+    };
+
+    // Blocks created with `new` live in the per-thread ControlBlockPool. Blocks are deleted
+    // through their concrete type, so the sized delete always sees the real size.
+    static void* operator new(size_t size) {
+        return ControlBlockPool::Allocate(size);
+    };
+    static void operator delete(void* ptr, size_t size) {
+        ControlBlockPool::Free(ptr, size);
+    };
+    // Over-aligned payloads do not fit the 16-byte pool slots.
+    static void* operator new(size_t size, std::align_val_t align) {
+        return ::operator new(size, align);
+    };
+    static void operator delete(void* ptr, size_t size, std::align_val_t align) {
+        ::operator delete(ptr, size, align);
+    };
+
+private:
+    bool TryIncStrong() {
+        CountPolicy policy = Policy();
+        if (policy == CountPolicy::kBiased) {
+            return BiasedIncIfNonZero();
+        }
+        if (policy == CountPolicy::kSharded) {
+            return ShardedIncIfNonZero();
+        }
+
+        uint64_t word = counts.load(std::memory_order_relaxed);
+        if (policy == CountPolicy::kSingleThreaded) {
+            if (word < kStrongOne) {
+                return false;
+            }
+            counts.store(word + kStrongOne, std::memory_order_relaxed);
+            return true;
+        }
+
+        do {
+            if (word < kStrongOne) {
+                return false;
+            }
+        } while (!counts.compare_exchange_weak(word, word + kStrongOne, std::memory_order_relaxed));
+        return true;
+    }
+
+    // The weak reference all strong owners share is dropped here too, it is not counted.
+    void DropWeak() {
+        if ((Subtract(kWeakOne) & kWeakMask) == 0) {
+            SMART_POINTERS_RECORD(*ops->type_info, kBlockFree);
+            ops->manage(this, BlockOp::kFreeBlock);
+        }
+    }
+
+    // A new reference is always made from an existing one, so nothing has to be ordered.
+    void Add(uint64_t delta) {
+        if (Policy() == CountPolicy::kSingleThreaded) {
+            counts.store(counts.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+        } else {
+            counts.fetch_add(delta, std::memory_order_relaxed);
+        }
+    }
+
+    // Returns the new word. acq_rel makes every write done through other owners visible to the
+    // thread that runs the destructor.
+    uint64_t Subtract(uint64_t delta) {
+        if (Policy() == CountPolicy::kSingleThreaded) {
+            uint64_t word = counts.load(std::memory_order_relaxed) - delta;
+            counts.store(word, std::memory_order_relaxed);
+            return word;
+        }
+
+        return counts.fetch_sub(delta, std::memory_order_acq_rel) - delta;
+    }
+
+    // kBiased counting, see BiasedControlBlockBase.
+    void BiasedInc();
+    bool BiasedIncIfNonZero();
+    bool BiasedDec();
+    size_t BiasedCount() const;
+
+    // kSharded counting, see ShardedControlBlockBase.
+    void ShardedInc();
+    bool ShardedIncIfNonZero();
+    bool ShardedDec();
+    size_t ShardedCount() const;
+};
+
+static_assert(sizeof(ControlBlockBase) == 16, "control block header must stay two words");
+
+// Per-thread owner record for biased control blocks. Threads that drive a block's shared count
+// below zero queue the block here, so that the owner can merge its local count into it.
+class BiasedOwner {
+public:
+    // Record of the calling thread, created on first use.
+    static BiasedOwner* Current() {
+        if (current_ == nullptr) {
+            static thread_local ThreadExit exit_guard;
+            current_ = new BiasedOwner();
+        }
+        return current_;
+    }
+    static bool IsCurrent(const BiasedOwner* owner) {
+        return owner == current_;
+    }
+
+    void AddRef() {
+        refs_.fetch_add(1, std::memory_order_relaxed);
+    }
+    void Release() {
+        if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete this;
+        }
+    }
+
+    inline void Enqueue(BiasedControlBlockBase* block);
+    // Merges every queued block. Runs on the owner thread, or anywhere once the owner has exited.
+    inline void Drain();
+    bool HasQueued() const {
+        return queue_.load(std::memory_order_relaxed) != nullptr;
+    }
+
+private:
+    // Once the thread is gone nobody can touch the local counts any more, so whoever queues a
+    // block after that point merges it on the spot.
+    struct ThreadExit {
+        ~ThreadExit() {
+            BiasedOwner* owner = current_;
+            current_ = nullptr;
+            owner->exited_.store(true);
+            owner->Drain();
+            owner->Release();
+        }
+    };
+
+    std::atomic<BiasedControlBlockBase*> queue_{nullptr};
+    std::atomic<bool> exited_{false};
+    std::atomic<size_t> refs_{1};  // the thread itself and every block it owns
+
+    static inline thread_local BiasedOwner* current_ = nullptr;
+};
+
+// Biased reference counting (Choi et al., PACT'18). The owner thread updates `biased_cnt` with
+// plain loads and stores. Everybody else uses the strong half of `counts`, which here stores a
+// signed shared count shifted left by two plus the kMerged / kQueued flags. The object is alive
+// while biased_cnt + shared count > 0.
+//
+// When biased_cnt drops to zero the owner sets kMerged, and from then on every thread (the owner
+// included) counts on the shared word alone. A reference made by the owner but dropped elsewhere
+// can push the shared count below zero while biased_cnt still looks positive. The dropping
+// thread then sets kQueued and hands the block to the owner, who folds biased_cnt into the shared
+// word on its next BiasedOwner::Drain.
+struct BiasedControlBlockBase : public ControlBlockBase {
+    static constexpr uint64_t kMerged = kStrongOne;
+    static constexpr uint64_t kQueued = kStrongOne << 1;
+    static constexpr uint64_t kOne = kStrongOne << 2;
+
+    explicit BiasedControlBlockBase(const BlockOps* ops)
+        : ControlBlockBase(ops), owner(BiasedOwner::Current()) {
+        counts.fetch_sub(kStrongOne, std::memory_order_relaxed);
+        owner->AddRef();
+        if (owner->HasQueued()) {
+            owner->Drain();
+        }
+    };
+
+    ~BiasedControlBlockBase() {
+        owner->Release();
+    };
+
+    static int64_t SharedCount(uint64_t word) {
+        return static_cast<int64_t>(word) >> (kStrongShift + 2);
+    }
+
+    bool OwnsFastPath() const {
+        return BiasedOwner::IsCurrent(owner) && !(counts.load(std::memory_order_relaxed) & kMerged);
+    }
+
+    void Inc() {
+        if (OwnsFastPath()) {
+            biased_cnt.store(biased_cnt.load(std::memory_order_relaxed) + 1,
+                             std::memory_order_relaxed);
+        } else {
+            counts.fetch_add(kOne, std::memory_order_relaxed);
+        }
+    }
+
+    bool IncIfNonZero() {
+        if (OwnsFastPath()) {  // unmerged means biased_cnt > 0
+            Inc();
+            return true;
+        }
+
+        uint64_t word = counts.load(std::memory_order_relaxed);
+        do {
+            if ((word & kMerged) && SharedCount(word) == 0) {
+                return false;
+            }
+        } while (!counts.compare_exchange_weak(word, word + kOne, std::memory_order_relaxed));
+        return true;
+    }
+
+    // Returns true when the object has to be destroyed.
+    bool Dec() {
+        if (OwnsFastPath()) {
+            size_t left = biased_cnt.load(std::memory_order_relaxed) - 1;
+            biased_cnt.store(left, std::memory_order_relaxed);
+            return left == 0 && Merge(0);
+        }
+
+        uint64_t word = counts.load(std::memory_order_relaxed);
+        uint64_t next;
+        do {
+            next = word - kOne;
+            if (!(word & (kMerged | kQueued)) && SharedCount(next) < 0) {
+                next |= kQueued;
+            }
+        } while (!counts.compare_exchange_weak(word, next, std::memory_order_acq_rel,
+                                               std::memory_order_relaxed));
+
+        if ((next & kQueued) && !(word & kQueued)) {
+            owner->Enqueue(this);
+            return false;
+        }
+        return (next & kMerged) && !(next & kQueued) && SharedCount(next) == 0;
+    }
+
+    // Folds biased_cnt into the shared word, `unqueue` clears kQueued in the same step.
+    // Only the owner (or a drainer after the owner exited) gets here, so biased_cnt and kMerged
+    // cannot change underneath. Returns true when the object has to be destroyed.
+    bool Merge(uint64_t unqueue) {
+        uint64_t word = counts.load(std::memory_order_relaxed);
+        uint64_t delta = -unqueue;
+        if (!(word & kMerged)) {
+            delta += biased_cnt.load(std::memory_order_relaxed) * kOne + kMerged;
+            biased_cnt.store(0, std::memory_order_relaxed);
+        }
+
+        word = counts.fetch_add(delta, std::memory_order_acq_rel) + delta;
+        return !(word & kQueued) && SharedCount(word) == 0;
+    }
+
+    size_t Count() const {
+        uint64_t word = counts.load(std::memory_order_relaxed);
+        int64_t count = SharedCount(word);
+        if (!(word & kMerged)) {
+            count += biased_cnt.load(std::memory_order_relaxed);
+        }
+        return count > 0 ? count : 0;
+    }
+
+    BiasedOwner* owner;
+    // Atomic only so that UseCount from another thread is not a data race: the owner never
+    // issues a read-modify-write on it.
+    std::atomic<size_t> biased_cnt{1};
+    BiasedControlBlockBase* next_queued = nullptr;
+};
+
+inline void BiasedOwner::Enqueue(BiasedControlBlockBase* block) {
+    block->next_queued = queue_.load(std::memory_order_relaxed);
+    while (!queue_.compare_exchange_weak(block->next_queued, block)) {
+    }
+    if (exited_.load()) {
+        Drain();
+    }
+}
+
+inline void BiasedOwner::Drain() {
+    // seq_cst, like the push and the exited_ accesses: Enqueue pushes, then loads exited_, and
+    // ThreadExit stores exited_, then takes the queue here. Only with all four in the single total
+    // order does at least one side see the other, so a block queued as the thread exits is
+    // merged by one of them.
+    BiasedControlBlockBase* block = queue_.exchange(nullptr);
+    while (block) {
+        BiasedControlBlockBase* next = block->next_queued;
+        if (block->Merge(BiasedControlBlockBase::kQueued)) {
+            block->DestroyObject();
+        }
+        block = next;
+    }
+}
+
+// Merges the biased blocks other threads handed back to the calling thread. Call it now and then
+// on long-lived threads that create kBiased objects and pass them around.
+inline void DrainBiasedQueue() {
+    BiasedOwner::Current()->Drain();
+}
 
-    virtual void ClearPtr() = 0;
+inline void ControlBlockBase::BiasedInc() {
+    static_cast<BiasedControlBlockBase*>(this)->Inc();
+}
 
-    virtual ~ControlBlockBase() = default;
+inline bool ControlBlockBase::BiasedIncIfNonZero() {
+    return static_cast<BiasedControlBlockBase*>(this)->IncIfNonZero();
+}
+
+inline bool ControlBlockBase::BiasedDec() {
+    return static_cast<BiasedControlBlockBase*>(this)->Dec();
+}
+
+inline size_t ControlBlockBase::BiasedCount() const {
+    return static_cast<const BiasedControlBlockBase*>(this)->Count();
+}
+
+// Strong count striped over kShards cache-line slots, a thread always counting in the same one,
+// so that copies of an object every core holds do not fight over one cache line. Zero detection
+// follows SNZI (Ellen et al., PODC'07): `central` counts the references taken directly plus the
+// slots that hold any, a slot arriving there before its first reference. A slot stays arrived
+// while it drops to zero and back, which keeps `central` out of the hot path, so as long as the
+// object lives on `central` is never zero.
+//
+// A reference dropped on a thread whose slot is empty is taken from `central` or from another
+// slot. When the direct references run out the block collapses: every slot is closed, empty ones
+// leave `central` at once and the others when they empty, and increments count directly. Only
+// then can `central`, and with it the count, reach zero. A hot object normally keeps one direct
+// reference, the one it was made with, until it is retired.
+struct ShardedControlBlockBase : public ControlBlockBase {
+    static constexpr size_t kShards = 64;
+
+    // `central`: direct references in the high half, arrived slots above the kCollapsed bit
+    static constexpr uint64_t kCollapsed = 1;
+    static constexpr uint64_t kArrivalOne = 2;
+    static constexpr uint64_t kDirectOne = uint64_t(1) << 32;
+
+    // Slot words: the slot's references above the kArrived and kClosed bits
+    static constexpr uint64_t kArrived = 1;
+    static constexpr uint64_t kClosed = 2;
+    static constexpr uint64_t kSlotOne = 4;
+
+    struct alignas(kCacheLineSize) Slot {
+        std::atomic<uint64_t> word{0};
+    };
+
+    explicit ShardedControlBlockBase(const BlockOps* ops) : ControlBlockBase(ops){};
+
+    // Threads take the slots round robin, in the order they first touch a sharded block.
+    static size_t Shard() {
+        static std::atomic<size_t> next{0};
+        static thread_local size_t shard = next.fetch_add(1, std::memory_order_relaxed) % kShards;
+        return shard;
+    }
+
+    void Inc() {
+        std::atomic<uint64_t>& slot = slots[Shard()].word;
+        uint64_t word = slot.load(std::memory_order_relaxed);
+        while (true) {
+            if (word & kClosed) {
+                central.fetch_add(kDirectOne, std::memory_order_relaxed);
+                return;
+            }
+            if (word & kArrived) {
+                if (slot.compare_exchange_weak(word, word + kSlotOne, std::memory_order_relaxed)) {
+                    return;
+                }
+                continue;
+            }
+            // Release: whoever empties the slot again departs after this arrival
+            central.fetch_add(kArrivalOne, std::memory_order_relaxed);
+            if (slot.compare_exchange_strong(word, word + kSlotOne + kArrived,
+                                             std::memory_order_release,
+                                             std::memory_order_relaxed)) {
+                return;
+            }
+            // Cannot reach zero: the caller's reference is counted somewhere
+            central.fetch_sub(kArrivalOne, std::memory_order_relaxed);
+        }
+    }
+
+    bool IncIfNonZero() {
+        // An open slot that has arrived means the block has not collapsed, so the object lives
+        std::atomic<uint64_t>& slot = slots[Shard()].word;
+        uint64_t word = slot.load(std::memory_order_relaxed);
+        while ((word & (kArrived | kClosed)) == kArrived) {
+            if (slot.compare_exchange_weak(word, word + kSlotOne, std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+
+        word = central.load(std::memory_order_relaxed);
+        do {
+            if ((word & ~kCollapsed) == 0) {
+                return false;
+            }
+        } while (
+            !central.compare_exchange_weak(word, word + kDirectOne, std::memory_order_relaxed));
+        return true;
+    }
+
+    // Returns true when the object has to be destroyed.
+    bool Dec() {
+        bool destroy = false;
+        if (DecSlot(slots[Shard()].word, destroy)) {
+            return destroy;
+        }
+
+        while (true) {
+            uint64_t word = central.load(std::memory_order_relaxed);
+            while (word >= 2 * kDirectOne) {
+                if (central.compare_exchange_weak(word, word - kDirectOne,
+                                                  std::memory_order_acq_rel,
+                                                  std::memory_order_relaxed)) {
+                    return false;
+                }
+            }
+            for (Slot& slot : slots) {
+                if (DecSlot(slot.word, destroy)) {
+                    return destroy;
+                }
+            }
+            // The last direct reference. Collapsing first keeps `central` off zero meanwhile.
+            if (word >= kDirectOne) {
+                if (!(word & kCollapsed)) {
+                    Collapse();
+                }
+                word = central.load(std::memory_order_relaxed);
+                while (word >= kDirectOne) {
+                    if (central.compare_exchange_weak(word, word - kDirectOne,
+                                                      std::memory_order_acq_rel,
+                                                      std::memory_order_relaxed)) {
+                        return ((word - kDirectOne) & ~kCollapsed) == 0;
+                    }
+                }
+            }
+            // Somebody else moved the reference around, look again
+        }
+    }
+
+    size_t Count() const {
+        size_t count = central.load(std::memory_order_relaxed) / kDirectOne;
+        for (const Slot& slot : slots) {
+            count += slot.word.load(std::memory_order_relaxed) / kSlotOne;
+        }
+        return count;
+    }
+
+    std::atomic<uint64_t> central{kDirectOne};
+    Slot slots[kShards];
+
+private:
+    // Takes a reference out of `slot`, false if it holds none. A closed slot leaves `central` with
+    // its last reference, and `destroy` tells whether that was the last one of all.
+    bool DecSlot(std::atomic<uint64_t>& slot, bool& destroy) {
+        uint64_t word = slot.load(std::memory_order_relaxed);
+        uint64_t next;
+        do {
+            if (word < kSlotOne) {
+                return false;
+            }
+            next = word - kSlotOne;
+            if (next < kSlotOne && (next & kClosed)) {
+                next &= ~kArrived;
+            }
+        } while (!slot.compare_exchange_weak(word, next, std::memory_order_acq_rel,
+                                             std::memory_order_relaxed));
+
+        destroy = (word & kArrived) && !(next & kArrived) && Depart();
+        return true;
+    }
+
+    bool Depart() {
+        uint64_t word = central.fetch_sub(kArrivalOne, std::memory_order_acq_rel) - kArrivalOne;
+        return (word & ~kCollapsed) == 0;
+    }
+
+    // Only called with a reference still counted in `central`, so nothing here reaches zero.
+    void Collapse() {
+        if (central.fetch_or(kCollapsed, std::memory_order_acq_rel) & kCollapsed) {
+            return;
+        }
+        for (Slot& slot : slots) {
+            uint64_t word = slot.word.load(std::memory_order_relaxed);
+            uint64_t next;
+            do {
+                next = word | kClosed;
+                if (word < kSlotOne) {
+                    next &= ~kArrived;
+                }
+            } while (!slot.word.compare_exchange_weak(word, next, std::memory_order_acq_rel,
+                                                      std::memory_order_relaxed));
+            if ((word & kArrived) && !(next & kArrived)) {
+                Depart();
+            }
+        }
+    }
 };
 
+inline void ControlBlockBase::ShardedInc() {
+    static_cast<ShardedControlBlockBase*>(this)->Inc();
+}
+
+inline bool ControlBlockBase::ShardedIncIfNonZero() {
+    return static_cast<ShardedControlBlockBase*>(this)->IncIfNonZero();
+}
+
+inline bool ControlBlockBase::ShardedDec() {
+    return static_cast<ShardedControlBlockBase*>(this)->Dec();
+}
+
+inline size_t ControlBlockBase::ShardedCount() const {
+    return static_cast<const ShardedControlBlockBase*>(this)->Count();
+}
+
+// Base of the concrete control blocks for a given counting policy.
+template <CountPolicy Policy>
+using ControlBlockBaseFor = std::conditional_t<
+    Policy == CountPolicy::kBiased, BiasedControlBlockBase,
+    std::conditional_t<Policy == CountPolicy::kSharded, ShardedControlBlockBase, ControlBlockBase>>;
+
 // magic trait - Hello EBO
 class ESFTBase {};
 
+// The weak reference lives inside the object. It is set once, by the SharedPtr constructor that
+// creates the first control block owning the object, so copying SharedPtr never touches it.
 template <typename T>
 class EnableSharedFromThis : public ESFTBase {
 public:
     SharedPtr<T> SharedFromThis() {
-        if (weak_this_ == nullptr) {
-            return SharedPtr<T>();
-        }
-
         return SharedPtr<T>(weak_this_);
     };
     SharedPtr<const T> SharedFromThis() const {
-        if (weak_this_const_) {
-            return SharedPtr<const T>(*weak_this_const_);
-        }
-
-        return SharedPtr<const T>();
+        return SharedPtr<T>(weak_this_);
     };
 
     WeakPtr<T> WeakFromThis() noexcept {
-        if (weak_this_ == nullptr) {
-            return WeakPtr<T>();
-        }
-
-        return *weak_this_;
+        return weak_this_;
     };
     WeakPtr<const T> WeakFromThis() const noexcept {
-        if (weak_this_const_) {
-            return WeakPtr<const T>(*weak_this_const_);
-        }
-
-        return WeakPtr<const T>();
+        return weak_this_;
     };
 
-    ~EnableSharedFromThis() {
-        if (weak_this_) {
-            delete weak_this_;
-        }
+protected:
+    EnableSharedFromThis(){};
+    // A copy is a different object, it must not share the original's owner
+    EnableSharedFromThis(const EnableSharedFromThis&){};
+    EnableSharedFromThis& operator=(const EnableSharedFromThis&) {
+        return *this;
     };
 
-    WeakPtr<T>* weak_this_ = nullptr;
-    WeakPtr<const T>* weak_this_const_ = nullptr;
+private:
+    template <typename U>
+    friend class SharedPtr;
+
+    mutable WeakPtr<T> weak_this_;
 };
 
 // new shared_ptr
-template <typename T>
-struct ControlBlockPointer : public ControlBlockBase {
-    explicit ControlBlockPointer(T* ptr) : ptr_(ptr){};
+template <typename T, typename Base = ControlBlockBase>
+struct ControlBlockPointer : public Base {
+    using Pointee = T;
 
-    ~ControlBlockPointer() override {
-        if (ptr_) {
-            delete ptr_;
-        }
-    }
+    explicit ControlBlockPointer(T* ptr, CountPolicy policy = CountPolicy::kAtomic)
+        : Base(OpsFor<&Manage, T>(policy)), ptr_(ptr) {
+        this->RecordCreated();
+    };
 
-    void ClearPtr() override {
-        if (ptr_) {
-            T* temp = ptr_;
-            ptr_ = nullptr;
-            delete temp;
+    static void Manage(ControlBlockBase* base, BlockOp op) {
+        auto* self = static_cast<ControlBlockPointer*>(base);
+        if (op == BlockOp::kDestroyObject) {
+            delete self->ptr_;
+        } else {
+            delete self;
         }
     }
 
     T* ptr_ = nullptr;
 };
 
+// The layout of ControlBlockEmplace<T, Base>, complete while that block is still being defined.
+// The object may start inside Base's tail padding, so its offset is read off this rather than
+// worked out from sizeof(Base).
+template <typename T, typename Base>
+struct EmplaceLayout : Base {
+    alignas(T) char storage_[sizeof(T)];
+};
+
+// The blocks are not standard-layout, which makes offsetof conditionally supported; GCC and Clang
+// support it and only warn.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Winvalid-offsetof"
+template <typename Block>
+constexpr size_t kStorageOffsetOf = offsetof(Block, storage_);
+#pragma GCC diagnostic pop
+
+// Whether a block keeps the object where its kStorageOffset says
+template <typename Block>
+constexpr bool kStorageOffsetMatches = kStorageOffsetOf<Block> == Block::kStorageOffset;
+
 // make_shared
-template <typename T>
-struct ControlBlockEmplace : public ControlBlockBase {
+template <typename T, typename Base = ControlBlockBase>
+struct ControlBlockEmplace : public Base {
+    using Pointee = T;
+
     template <typename... Args>
-    ControlBlockEmplace(Args&&... args) {
+    explicit ControlBlockEmplace(CountPolicy policy, Args&&... args)
+        : Base(OpsFor<&Manage, T>(policy)) {
         new (&storage_[0]) T(std::forward<Args>(args)...);
+        this->RecordCreated();
     }
 
-    ~ControlBlockEmplace() override {
-        if (!is_delete_) {
-            std::destroy_at(std::launder(reinterpret_cast<T*>(&storage_[0])));
+    static void Manage(ControlBlockBase* base, BlockOp op) {
+        static_assert(kStorageOffsetMatches<ControlBlockEmplace>,
+                      "kStorageOffset no longer matches the block layout");
+        auto* self = static_cast<ControlBlockEmplace*>(base);
+        if (op == BlockOp::kDestroyObject) {
+            std::destroy_at(std::launder(self->GetPtr()));
+        } else {
+            delete self;
         }
-    };
+    }
 
     T* GetPtr() {
         return reinterpret_cast<T*>(&storage_[0]);
     }
 
-    void ClearPtr() override {
-        if (!is_delete_) {
-            is_delete_ = true;
-            std::destroy_at(std::launder(reinterpret_cast<T*>(&storage_[0])));
+    // The object's address follows from the block address alone. ControlBlockAllocated keeps
+    // this layout, it only appends the allocator.
+    static constexpr size_t kStorageOffset = kStorageOffsetOf<EmplaceLayout<T, Base>>;
+
+    alignas(T) char storage_[sizeof(T)];
+};
+
+// make_shared for arrays, T[N] uses the T[] block as well. One allocation: the elements start on
+// a cache line of their own after the block, and the element count sits right in front of them,
+// in the padding, so it can be found from the element pointer alone.
+template <typename T, typename Base>
+struct ControlBlockEmplace<T[], Base> : public Base {
+    static_assert(!std::is_array_v<T>, "multidimensional arrays are not supported");
+
+    using Pointee = T[];
+
+    static constexpr size_t kAlign = alignof(T) > kCacheLineSize ? alignof(T) : kCacheLineSize;
+    static constexpr size_t kElementsOffset =
+        (sizeof(Base) + sizeof(size_t) + kAlign - 1) / kAlign * kAlign;
+
+    // `value_init` zeroes trivial elements, otherwise they are left as the allocator gave them.
+    static ControlBlockEmplace* Create(CountPolicy policy, size_t size, bool value_init) {
+        if (size > (SIZE_MAX - kElementsOffset) / sizeof(T)) {
+            throw std::bad_array_new_length();
         }
+
+        void* memory = ::operator new(kElementsOffset + size * sizeof(T), std::align_val_t(kAlign));
+        ControlBlockEmplace* block = nullptr;
+        try {
+            block = ::new (memory) ControlBlockEmplace(policy);
+            if (value_init) {
+                std::uninitialized_value_construct_n(block->GetPtr(), size);
+            } else {
+                std::uninitialized_default_construct_n(block->GetPtr(), size);
+            }
+        } catch (...) {
+            if (block) {
+                block->~ControlBlockEmplace();
+            }
+            ::operator delete(memory, std::align_val_t(kAlign));
+            throw;
+        }
+        *SizeSlot(block->GetPtr()) = size;
+        block->RecordCreated();
+        return block;
     }
 
-    alignas(T) char storage_[sizeof(T)];
-    bool is_delete_ = false;
+    static void Manage(ControlBlockBase* base, BlockOp op) {
+        auto* self = static_cast<ControlBlockEmplace*>(base);
+        if (op == BlockOp::kDestroyObject) {
+            std::destroy_n(self->GetPtr(), Size(self->GetPtr()));
+        } else {
+            self->~ControlBlockEmplace();
+            ::operator delete(static_cast<void*>(self), std::align_val_t(kAlign));
+        }
+    }
+
+    T* GetPtr() {
+        return reinterpret_cast<T*>(reinterpret_cast<char*>(this) + kElementsOffset);
+    }
+
+    static size_t Size(const T* elements) {
+        return reinterpret_cast<const size_t*>(elements)[-1];
+    }
+
+private:
+    explicit ControlBlockEmplace(CountPolicy policy) : Base(OpsFor<&Manage, T[]>(policy)){};
+
+    static size_t* SizeSlot(T* elements) {
+        return reinterpret_cast<size_t*>(elements) - 1;
+    }
+};
+
+// new shared_ptr with a custom deleter, stateless deleters take no space
+template <typename T, typename Deleter, typename Base = ControlBlockBase>
+struct ControlBlockDeleter : public Base {
+    using Pointee = T;
+
+    ControlBlockDeleter(T* ptr, Deleter deleter, CountPolicy policy = CountPolicy::kAtomic)
+        : Base(OpsFor<&Manage, T>(policy)), data_(ptr, std::move(deleter)) {
+        this->RecordCreated();
+    };
+
+    static void Manage(ControlBlockBase* base, BlockOp op) {
+        auto* self = static_cast<ControlBlockDeleter*>(base);
+        if (op == BlockOp::kDestroyObject) {
+            self->data_.GetSecond()(self->data_.GetFirst());
+        } else {
+            delete self;
+        }
+    }
+
+    CompressedPair<T*, Deleter> data_;
+};
+
+// Any of the blocks above, placed by the user's allocator instead of the control block pool.
+// The allocator sits in an EBO slot, so std::allocator and friends add nothing.
+template <typename Alloc, typename U>
+using ReboundAlloc = typename std::allocator_traits<Alloc>::template rebind_alloc<U>;
+
+template <typename Block, typename Alloc>
+struct ControlBlockAllocated
+    : public Block,
+      private CompressedPairElement<ReboundAlloc<Alloc, ControlBlockAllocated<Block, Alloc>>, 0> {
+    using BlockAlloc = ReboundAlloc<Alloc, ControlBlockAllocated>;
+    using BlockTraits = std::allocator_traits<BlockAlloc>;
+    using AllocSlot = CompressedPairElement<BlockAlloc, 0>;
+
+    template <typename... Args>
+    ControlBlockAllocated(const Alloc& alloc, Args&&... args)
+        : Block(std::forward<Args>(args)...), AllocSlot(BlockAlloc(alloc)) {
+        this->ops = OpsFor<&Manage, typename Block::Pointee>(this->ops->policy);
+    };
+
+    template <typename... Args>
+    static ControlBlockAllocated* Create(const Alloc& alloc, Args&&... args) {
+        BlockAlloc block_alloc(alloc);
+        auto* memory = BlockTraits::allocate(block_alloc, 1);
+        try {
+            return ::new (static_cast<void*>(memory))
+                ControlBlockAllocated(alloc, std::forward<Args>(args)...);
+        } catch (...) {
+            BlockTraits::deallocate(block_alloc, memory, 1);
+            throw;
+        }
+    }
+
+    static void Manage(ControlBlockBase* base, BlockOp op) {
+        auto* self = static_cast<ControlBlockAllocated*>(base);
+        if (op == BlockOp::kDestroyObject) {
+            Block::Manage(base, op);
+            return;
+        }
+
+        BlockAlloc block_alloc(self->AllocSlot::GetValue());
+        self->~ControlBlockAllocated();
+        BlockTraits::deallocate(block_alloc, self, 1);
+    }
 };
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdio.h>
+
+// Minimal checks for the tests in this directory. A failing CHECK reports itself and the test
+// keeps going; main returns TestResult(), non-zero if anything failed.
+
+inline int& TestFailures() {
+    static int failures = 0;
+    return failures;
+}
+
+#define CHECK(...)                                                                            \
+    do {                                                                                      \
+        if (!(__VA_ARGS__)) {                                                                 \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #__VA_ARGS__);   \
+            ++TestFailures();                                                                 \
+        }                                                                                     \
+    } while (false)
+
+#define CHECK_THROWS(statement, exception)                                                    \
+    do {                                                                                      \
+        bool thrown = false;                                                                  \
+        try {                                                                                 \
+            statement;                                                                        \
+        } catch (const exception&) {                                                          \
+            thrown = true;                                                                    \
+        }                                                                                     \
+        if (!thrown) {                                                                        \
+            fprintf(stderr, "%s:%d: %s did not throw %s\n", __FILE__, __LINE__, #statement,   \
+                    #exception);                                                              \
+            ++TestFailures();                                                                 \
+        }                                                                                     \
+    } while (false)
+
+inline int TestResult() {
+    if (TestFailures() != 0) {
+        fprintf(stderr, "%d check(s) failed\n", TestFailures());
+        return 1;
+    }
+    return 0;
+}
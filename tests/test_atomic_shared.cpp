@@ -0,0 +1,80 @@
+#include "check.h"
+
+#include "atomic_shared.h"
+#include "weak.h"
+
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct Config {
+    explicit Config(int version) : version(version), payload(8, version){};
+    ~Config() {
+        version = -1;
+    }
+    int version;
+    std::vector<int> payload;
+};
+
+void TestSingleThread() {
+    AtomicSharedPtr<int> cell;
+    CHECK(!cell.Load());
+
+    SharedPtr<int> expected;
+    auto value = MakeShared<int>(3);
+    CHECK(cell.CompareExchange(expected, value));
+    CHECK(*cell.Load() == 3);
+    CHECK(!cell.CompareExchange(expected, MakeShared<int>(4)));
+    CHECK(expected == value);
+
+    auto old = cell.Exchange(MakeShared<int>(5));
+    CHECK(old == value && *cell.Load() == 5);
+    cell.Store(nullptr);
+    CHECK(!cell.Load() && value.UseCount() == 3);
+}
+
+void TestReadersAndWriters() {
+    AtomicSharedPtr<Config> cell(MakeShared<Config>(0));
+    std::atomic<bool> stop{false};
+    std::vector<std::thread> readers;
+    for (int i = 0; i < 3; ++i) {
+        readers.emplace_back([&] {
+            while (!stop.load()) {
+                auto config = cell.Load();
+                CHECK(config && config->version >= 0 && config->payload[3] == config->version);
+            }
+        });
+    }
+
+    std::vector<std::thread> writers;
+    for (int i = 0; i < 2; ++i) {
+        writers.emplace_back([&] {
+            for (int k = 1; k < 5000; ++k) {
+                if (k % 3 == 0) {
+                    auto expected = cell.Load();
+                    cell.CompareExchange(expected, MakeShared<Config>(k));
+                } else if (k % 3 == 1) {
+                    cell.Store(MakeShared<Config>(k));
+                } else {
+                    CHECK(cell.Exchange(MakeShared<Config>(k))->version >= 0);
+                }
+            }
+        });
+    }
+    for (auto& writer : writers) {
+        writer.join();
+    }
+    stop = true;
+    for (auto& reader : readers) {
+        reader.join();
+    }
+}
+
+}  // namespace
+
+int main() {
+    TestSingleThread();
+    TestReadersAndWriters();
+    return TestResult();
+}
@@ -0,0 +1,89 @@
+#include "check.h"
+
+#include "compact_shared.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Node : EnableSharedFromThis<Node> {
+    explicit Node(std::string name) : name(std::move(name)){};
+    std::string name;
+};
+
+struct alignas(64) Wide {
+    int value = 7;
+};
+
+struct Mixin {
+    int mixin = 2;
+};
+struct Base {
+    virtual ~Base() = default;
+};
+struct Derived : Mixin, Base {};
+
+void TestConversions() {
+    static_assert(sizeof(CompactSharedPtr<int>) == sizeof(void*));
+
+    auto compact = MakeCompactShared<Node>("x");
+    CHECK(compact->name == "x" && compact.UseCount() == 1);
+    SharedPtr<Node> shared = compact;
+    CHECK(shared.Get() == compact.Get() && compact.UseCount() == 2);
+    CHECK(compact->SharedFromThis().Get() == compact.Get());
+
+    WeakPtr<Node> weak = compact;
+    CompactSharedPtr<Node> from_weak(weak);
+    CHECK(from_weak == compact && compact.UseCount() == 3);
+
+    CompactSharedPtr<Node> moved(std::move(shared));
+    CHECK(!shared && moved.Get() == compact.Get());
+    SharedPtr<Node> back = std::move(moved);
+    CHECK(!moved && back.Get() == compact.Get());
+
+    CompactSharedPtr<int> empty;
+    SharedPtr<int> from_empty = empty;
+    CHECK(!from_empty && !CompactSharedPtr<int>(SharedPtr<int>{}));
+}
+
+// The object's offset in the block depends on the policy and on alignof(T)
+template <CountPolicy Policy>
+void CheckOverAligned() {
+    auto compact = MakeCompactShared<Wide, Policy>();
+    CHECK(reinterpret_cast<uintptr_t>(compact.Get()) % alignof(Wide) == 0 && compact->value == 7);
+    auto shared = MakeShared<Wide, Policy>();
+    CompactSharedPtr<Wide> from_shared(shared);
+    CHECK(from_shared.Get() == shared.Get() && SharedPtr<Wide>(from_shared).Get() == shared.Get());
+}
+
+void TestPolicies() {
+    CHECK(*MakeCompactShared<int, CountPolicy::kBiased>(5) == 5);
+    CHECK(*MakeCompactShared<int, CountPolicy::kSingleThreaded>(6) == 6);
+    CheckOverAligned<CountPolicy::kAtomic>();
+    CheckOverAligned<CountPolicy::kSingleThreaded>();
+    CheckOverAligned<CountPolicy::kBiased>();
+    CheckOverAligned<CountPolicy::kSharded>();
+    CHECK(*CompactSharedPtr<int>(MakeSharedSharded<int>(8)) == 8);
+    CompactSharedPtr<int> allocated(AllocateShared<int>(std::allocator<int>(), 9));
+    CHECK(*allocated == 9);
+}
+
+void TestRejected() {
+    // Not an emplaced block
+    CHECK_THROWS(CompactSharedPtr<int>(SharedPtr<int>(new int(1))), BadCompactPtr);
+    // Points into the object, but not at its start: the polymorphic Base is laid out first
+    SharedPtr<Mixin> at_offset = MakeShared<Derived>();
+    CHECK_THROWS(CompactSharedPtr<Mixin>{at_offset}, BadCompactPtr);
+    CHECK(at_offset.UseCount() == 1);
+}
+
+}  // namespace
+
+int main() {
+    TestConversions();
+    TestPolicies();
+    TestRejected();
+    return TestResult();
+}
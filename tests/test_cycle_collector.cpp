@@ -0,0 +1,197 @@
+#include "check.h"
+
+#include "cycle_collector.h"
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct Payload {
+    static inline std::atomic<int> alive{0};
+    Payload() {
+        ++alive;
+    }
+    ~Payload() {
+        --alive;
+    }
+};
+
+struct Subscription;
+
+struct Session {
+    static inline std::atomic<int> alive{0};
+    Session() {
+        ++alive;
+    }
+    ~Session() {
+        --alive;
+    }
+    void Trace(CycleTracer& tracer) const {
+        for (const auto& subscription : subscriptions) {
+            tracer.Visit(subscription);
+        }
+    }
+    std::vector<CollectableSharedPtr<Subscription>> subscriptions;
+};
+
+struct Subscription {
+    static inline std::atomic<int> alive{0};
+    Subscription() {
+        ++alive;
+    }
+    ~Subscription() {
+        --alive;
+    }
+    void Trace(CycleTracer& tracer) const {
+        tracer.Visit(session);
+        tracer.Visit(payload);
+    }
+    CollectableSharedPtr<Session> session;
+    CollectableSharedPtr<Payload> payload;  // a leaf, never a candidate itself
+};
+
+struct Node {
+    static inline std::atomic<int> alive{0};
+    Node() {
+        ++alive;
+    }
+    virtual ~Node() {
+        --alive;
+    }
+    void Trace(CycleTracer& tracer) const {
+        tracer.Visit(next);
+    }
+    CollectableSharedPtr<Node> next;
+};
+struct DerivedNode : Node {};
+
+CollectableSharedPtr<Session> Subscribe(CycleCollector& collector, int subscriptions) {
+    auto session = MakeCollectableIn<Session>(collector);
+    for (int i = 0; i < subscriptions; ++i) {
+        auto subscription = MakeCollectableIn<Subscription>(collector);
+        subscription->session = session;
+        subscription->payload = MakeCollectableIn<Payload>(collector);
+        session->subscriptions.push_back(subscription);
+    }
+    return session;
+}
+
+bool NoneAlive() {
+    return Session::alive == 0 && Subscription::alive == 0 && Payload::alive == 0 &&
+           Node::alive == 0;
+}
+
+void TestCycles() {
+    CycleCollector collector;
+    {
+        auto session = Subscribe(collector, 3);
+        CHECK(collector.Candidates() > 0);
+        CHECK(collector.Collect() == 0);  // all of it is still referenced from here
+        CHECK(Session::alive == 1 && Subscription::alive == 3);
+    }
+    CHECK(Session::alive == 1);  // leaked, until
+    CHECK(collector.Collect() == 7);
+    CHECK(NoneAlive() && collector.Candidates() == 0);
+
+    // Held from outside through one subscription only
+    auto session = Subscribe(collector, 2);
+    CollectableSharedPtr<Subscription> kept = session->subscriptions[0];
+    session.Reset();
+    CHECK(collector.Collect() == 0 && Session::alive == 1);
+    kept.Reset();
+    CHECK(collector.Collect() == 5 && NoneAlive());
+
+    // Dropped acyclic objects are destroyed right away, no collection needed
+    auto payload = MakeCollectableIn<Payload>(collector);
+    auto copy = payload;
+    copy.Reset();
+    payload.Reset();
+    CHECK(Payload::alive == 0 && collector.Candidates() == 0);
+}
+
+void TestShapes() {
+    CycleCollector collector;
+    {
+        CollectableSharedPtr<Node> self = MakeCollectableIn<DerivedNode>(collector);
+        self->next = self;
+    }
+    // A long ring: the traversals must not recurse
+    {
+        auto first = MakeCollectableIn<Node>(collector);
+        Node* last = first.Get();
+        for (int i = 0; i < 200000; ++i) {
+            last->next = MakeCollectableIn<Node>(collector);
+            last = last->next.Get();
+        }
+        last->next = first;
+    }
+    CHECK(Node::alive == 200002);
+    CHECK(collector.Collect() == 200002 && Node::alive == 0);
+
+    // A leaf of a garbage cycle that is owned from outside as well
+    CollectableSharedPtr<Payload> payload;
+    {
+        auto session = Subscribe(collector, 2);
+        payload = session->subscriptions[1]->payload;
+    }
+    CHECK(collector.Collect() == 4 && Payload::alive == 1 && payload.UseCount() == 1);
+}
+
+void TestIncremental() {
+    CycleCollector collector;
+    for (int i = 0; i < 1000; ++i) {
+        Subscribe(collector, 1);
+    }
+    size_t freed = 0;
+    size_t steps = 0;
+    CollectStats stats;
+    do {
+        stats = collector.Collect(std::chrono::nanoseconds(0));
+        freed += stats.freed;
+        ++steps;
+    } while (stats.pending > 0);
+    CHECK(freed == 3000 && NoneAlive());
+    CHECK(steps > 1);
+}
+
+void TestThreads() {
+    CycleCollector collector;
+    std::vector<CollectableSharedPtr<Session>> sessions;
+    for (int i = 0; i < 64; ++i) {
+        sessions.push_back(Subscribe(collector, 4));
+    }
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&, t] {
+            for (size_t i = t; i < sessions.size(); i += 4) {
+                auto again = sessions[i];
+                sessions[i].Reset();
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    CHECK(collector.Collect() == 64 * 9 && NoneAlive());
+
+    // The global collector
+    {
+        auto session = MakeCollectable<Session>();
+        auto subscription = MakeCollectable<Subscription>();
+        subscription->session = session;
+        session->subscriptions.push_back(subscription);
+    }
+    CHECK(CycleCollector::Global().Collect() == 2 && NoneAlive());
+}
+
+}  // namespace
+
+int main() {
+    TestCycles();
+    TestShapes();
+    TestIncremental();
+    TestThreads();
+    return TestResult();
+}
@@ -0,0 +1,101 @@
+#include "check.h"
+
+#include "deferred.h"
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+namespace {
+
+std::vector<int>& Destroyed() {
+    static std::vector<int> destroyed;
+    return destroyed;
+}
+
+struct Tree : EnableSharedFromThis<Tree> {
+    static inline std::atomic<int> alive{0};
+    explicit Tree(int id = 0) : id(id) {
+        ++alive;
+    }
+    ~Tree() {
+        Destroyed().push_back(id);
+        --alive;
+    }
+    int id;
+    SharedPtr<Tree> child;
+};
+
+void TestControlBlockMode() {
+    Destroyed().clear();
+    auto emplaced = MakeSharedDeferred<Tree>(1);
+    auto adopted = AdoptSharedDeferred(new Tree(2));
+    WeakPtr<Tree> weak(emplaced);
+    CHECK(emplaced->SharedFromThis() == emplaced && Tree::alive == 2);
+
+    emplaced.Reset();
+    adopted.Reset();
+    // Expired for everybody right away, destroyed only by the drain
+    CHECK(weak.Expired() && !weak.Lock() && Tree::alive == 2);
+    CHECK(!DeferredReclaimer::Global().Empty());
+    CHECK(DrainDeferred() == 2 && Tree::alive == 0);
+    CHECK((Destroyed() == std::vector<int>{1, 2}));
+    CHECK(DeferredReclaimer::Global().Empty() && DrainDeferred() == 0);
+
+    auto biased = MakeSharedDeferred<Tree, CountPolicy::kBiased>(3);
+    auto sharded = MakeSharedDeferred<Tree, CountPolicy::kSharded>(4);
+    biased.Reset();
+    sharded.Reset();
+    CHECK(DrainDeferred() == 2 && Tree::alive == 0);
+}
+
+void TestNested() {
+    Destroyed().clear();
+    auto root = MakeSharedDeferred<Tree>(1);
+    root->child = MakeSharedDeferred<Tree>(2);
+    root->child->child = MakeShared<Tree>(3);
+    root.Reset();
+    // The root's destructor queues its child, the same drain picks it up
+    CHECK(DrainDeferred() == 2 && Tree::alive == 0);
+    CHECK((Destroyed() == std::vector<int>{1, 2, 3}));
+}
+
+void TestDeleterMode() {
+    static_assert(sizeof(UniquePtr<Tree, DeferredDelete<Tree>>) == sizeof(Tree*));
+    {
+        UniquePtr<Tree, DeferredDelete<Tree>> unique(new Tree(1));
+        UniquePtr<int[], DeferredDelete<int[]>> array(new int[1000]);
+        SharedPtr<Tree> shared(new Tree(2), DeferredDelete<Tree>());
+        UniquePtr<Tree, DeferredDelete<Tree>> empty;
+    }
+    CHECK(Tree::alive == 2);
+    CHECK(DrainDeferred() == 3 && Tree::alive == 0);
+}
+
+void TestReclaimerThread() {
+    {
+        ReclaimerThread reclaimer(std::chrono::microseconds(100));
+        for (int i = 0; i < 100; ++i) {
+            MakeSharedDeferred<Tree>(i);
+            UniquePtr<Tree, DeferredDelete<Tree>>(new Tree(i));
+        }
+        for (int i = 0; i < 1000 && Tree::alive != 0; ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        CHECK(Tree::alive == 0);
+
+        MakeSharedDeferred<Tree>(0);
+    }
+    // Drained before the thread stops
+    CHECK(Tree::alive == 0 && DeferredReclaimer::Global().Empty());
+}
+
+}  // namespace
+
+int main() {
+    TestControlBlockMode();
+    TestNested();
+    TestDeleterMode();
+    TestReclaimerThread();
+    return TestResult();
+}
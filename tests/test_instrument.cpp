@@ -0,0 +1,115 @@
+// Builds with instrumentation on whatever the CMake option says.
+#ifndef SMART_POINTERS_INSTRUMENT
+#define SMART_POINTERS_INSTRUMENT
+#endif
+
+#include "check.h"
+
+#include "intrusive.h"
+#include "shared.h"
+#include "weak.h"
+
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct Widget {
+    int value = 1;
+};
+
+struct Gadget {
+    int value = 2;
+};
+
+struct Node : WeakRefCounted<Node> {};
+
+PointerTypeStats StatsOf(std::string_view type) {
+    for (PointerTypeStats& stats : SnapshotPointerStats()) {
+        if (stats.type.find(type) != std::string::npos) {
+            return stats;
+        }
+    }
+    return {};
+}
+
+void TestShared() {
+    {
+        auto widget = MakeShared<Widget>();
+        auto copy = widget;
+        WeakPtr<Widget> weak(widget);
+        copy.Reset();
+        widget.Reset();
+        CHECK(!weak.Lock());
+    }
+    PointerTypeStats stats = StatsOf("Widget");
+    CHECK(stats.type.find("Widget") != std::string::npos);
+    CHECK(stats.Count(PointerEvent::kBlockAlloc) == 1);
+    CHECK(stats.Count(PointerEvent::kBlockFree) == 1);
+    CHECK(stats.Count(PointerEvent::kStrongInc) == 1 && stats.Count(PointerEvent::kStrongDec) == 2);
+    CHECK(stats.Count(PointerEvent::kWeakInc) == 1 && stats.Count(PointerEvent::kWeakDec) == 1);
+    CHECK(stats.Count(PointerEvent::kLockFailure) == 1);
+    CHECK(stats.live == 0);  // one object is below the peak's batching, see kLiveBatch
+
+    std::vector<SharedPtr<Widget>> many;
+    for (int i = 0; i < 1000; ++i) {
+        many.push_back(MakeShared<Widget>());
+    }
+    CHECK(StatsOf("Widget").live == 1000);
+    many.clear();
+    stats = StatsOf("Widget");
+    CHECK(stats.live == 0 && stats.peak >= 1000);
+}
+
+void TestThreads() {
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([] {
+            std::vector<SharedPtr<Gadget>> local;
+            for (int i = 0; i < 10000; ++i) {
+                local.push_back(MakeShared<Gadget>());
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    PointerTypeStats stats = StatsOf("Gadget");
+    CHECK(stats.Count(PointerEvent::kObjectCreate) == 40000);
+    CHECK(stats.Count(PointerEvent::kBlockFree) == 40000);
+    CHECK(stats.live == 0 && stats.peak > 10000 - instrument_detail::kLiveBatch);
+}
+
+void TestIntrusive() {
+    IntrusiveWeakPtr<Node> weak;
+    {
+        auto node = MakeIntrusive<Node>();
+        auto copy = node;
+        weak = IntrusiveWeakPtr<Node>(node);
+        CHECK(StatsOf("Node").live == 1);
+    }
+    CHECK(!weak.Lock());
+    weak.Reset();
+
+    PointerTypeStats stats = StatsOf("Node");
+    CHECK(stats.live == 0 && stats.Count(PointerEvent::kObjectCreate) == 1);
+    CHECK(stats.Count(PointerEvent::kStrongInc) == stats.Count(PointerEvent::kStrongDec));
+    CHECK(stats.Count(PointerEvent::kBlockAlloc) == 1);
+    CHECK(stats.Count(PointerEvent::kBlockFree) == 1);
+    CHECK(stats.Count(PointerEvent::kLockFailure) == 1);
+}
+
+}  // namespace
+
+int main() {
+    TestShared();
+    TestThreads();
+    TestIntrusive();
+
+    FILE* sink = tmpfile();
+    DumpPointerStats(sink);
+    CHECK(ftell(sink) > 0);
+    fclose(sink);
+    return TestResult();
+}
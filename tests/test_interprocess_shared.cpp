@@ -0,0 +1,181 @@
+#include "check.h"
+
+#include "interprocess_shared.h"
+
+#include <cstring>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+struct Entry {
+    uint64_t key;
+    uint64_t value;
+};
+
+// The entries are a second allocation in the segment, reached through an OffsetPtr
+struct Table {
+    Table(SharedMemorySegment& segment, size_t size)
+        : size(size), entries(static_cast<Entry*>(segment.Allocate(size * sizeof(Entry)))) {
+        for (size_t i = 0; i < size; ++i) {
+            entries[i] = Entry{i, i * i};
+        }
+    }
+    ~Table() {
+        SharedMemorySegment::Deallocate(entries.Get());
+    }
+    uint64_t Sum() const {
+        uint64_t sum = 0;
+        for (size_t i = 0; i < size; ++i) {
+            sum += entries[i].value;
+        }
+        return sum;
+    }
+    size_t size;
+    OffsetPtr<Entry> entries;
+    std::atomic<uint64_t> readers{0};
+};
+
+struct Reply {
+    uint64_t sum;
+    InterprocessSharedPtr<Table> table;  // an owner stored in the segment
+};
+
+std::string SegmentName(const char* test) {
+    return "/smart_pointers_" + std::string(test) + "_" + std::to_string(getpid());
+}
+
+void TestOffsetPtr() {
+    struct Node {
+        int value = 5;
+        OffsetPtr<int> self;
+    };
+    alignas(Node) unsigned char first[sizeof(Node)];
+    alignas(Node) unsigned char second[sizeof(Node)];
+    auto* node = ::new (first) Node();
+    node->self = &node->value;
+
+    // The bytes mean the same thing wherever they are, that is the point
+    std::memcpy(second, first, sizeof(Node));
+    auto* moved = reinterpret_cast<Node*>(second);
+    CHECK(moved->self.Get() == &moved->value && *node->self == 5);
+
+    OffsetPtr<int> copy = node->self;
+    OffsetPtr<const int> to_const = copy;
+    OffsetPtr<int> null;
+    CHECK(copy == node->self && to_const.Get() == &node->value && !null && null.Get() == nullptr);
+}
+
+void TestTwoMappings() {
+    std::string name = SegmentName("mappings");
+    auto segment = SharedMemorySegment::Create(name, 1 << 20);
+    auto again = SharedMemorySegment::Open(name);
+    SharedMemorySegment::Unlink(name);  // the mappings keep it
+    CHECK(segment.Base() != again.Base() && again.Size() == segment.Size());
+
+    auto table = segment.MakeShared<Table>(segment, 1000);
+    segment.Publish("table", table);
+    auto found = again.Find<Table>("table");
+    CHECK(found && found.Get() != table.Get() && found->Sum() == table->Sum());
+    CHECK(table.UseCount() == 3 && found.UseCount() == 3);
+
+    // An owner inside the segment, made through one mapping and dropped through the other
+    auto reply = segment.MakeShared<Reply>(Reply{found->Sum(), found});
+    CHECK(table.UseCount() == 4);
+    auto reply_there = again.Find<Reply>("reply");
+    CHECK(!reply_there);
+    again.Publish("reply", reply);
+    reply.Reset();
+    reply_there = segment.Find<Reply>("reply");
+    CHECK(reply_there->table->Sum() == reply_there->sum);
+    reply_there.Reset();
+    segment.Unpublish<Reply>("reply");
+
+    CHECK_THROWS(again.Find<Entry>("table"), BadSegmentType);
+    CHECK_THROWS(segment.Publish("table", segment.MakeShared<Entry>()), BadSegmentType);
+    CHECK(table.UseCount() == 3);
+
+    table.Reset();
+    found.Reset();
+    CHECK(segment.Allocated() != 0);
+    again.Unpublish<Table>("table");
+    CHECK(segment.Allocated() == 0 && !segment.Find<Table>("table"));
+}
+
+void TestAllocator() {
+    std::string name = SegmentName("allocator");
+    auto segment = SharedMemorySegment::Create(name, 64 << 10);
+    CHECK_THROWS(SharedMemorySegment::Create(name, 64 << 10), std::system_error);
+    SharedMemorySegment::Unlink(name);
+    CHECK_THROWS(SharedMemorySegment::Open(name), std::system_error);
+
+    void* first = segment.Allocate(100);
+    CHECK(reinterpret_cast<uintptr_t>(first) % interprocess_detail::kAlignment == 0);
+    SharedMemorySegment::Deallocate(first);
+    CHECK(segment.Allocate(100) == first && segment.Allocated() >= 100);
+    SharedMemorySegment::Deallocate(first);
+
+    CHECK_THROWS(segment.Allocate(1 << 20), std::bad_alloc);
+    CHECK_THROWS(segment.MakeShared<Table>(segment, 1 << 20), std::bad_alloc);
+    CHECK(segment.Allocated() == 0);
+}
+
+int ChildMain(const std::string& name, int child, uint64_t sum) {
+    // A mapping of its own, at whatever address the child gets
+    auto attached = SharedMemorySegment::Open(name);
+    auto found = attached.Find<Table>("table");
+    bool ok = found && found->Sum() == sum;
+    for (int i = 0; i < 1000; ++i) {
+        auto copy = found;
+        ok = ok && copy.UseCount() >= 3;
+    }
+    found->readers.fetch_add(1);
+    if (child == 0) {
+        attached.Publish("reply", attached.MakeShared<Reply>(Reply{found->Sum(), found}));
+    }
+    return ok ? 0 : 1;
+}
+
+void TestFork() {
+    std::string name = SegmentName("fork");
+    auto segment = SharedMemorySegment::Create(name, 1 << 20);
+    auto table = segment.MakeShared<Table>(segment, 10'000);
+    segment.Publish("table", table);
+
+    constexpr int kChildren = 4;
+    for (int child = 0; child < kChildren; ++child) {
+        if (fork() == 0) {
+            // _exit skips the destructors of the parent's pointers copied into the child, which
+            // must not release the parent's references; the child's own are dropped in ChildMain.
+            _exit(ChildMain(name, child, table->Sum()));
+        }
+    }
+    for (int child = 0; child < kChildren; ++child) {
+        int status = 0;
+        wait(&status);
+        CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+    SharedMemorySegment::Unlink(name);
+
+    // The children's references are all back, but the one inside the published reply
+    CHECK(table->readers == kChildren && table.UseCount() == 3);
+    auto reply = segment.Find<Reply>("reply");
+    CHECK(reply && reply->sum == table->Sum() && reply->table.Get() == table.Get());
+    reply.Reset();
+    segment.Unpublish<Reply>("reply");
+    segment.Unpublish<Table>("table");
+    CHECK(table.UseCount() == 1);
+    table.Reset();
+    CHECK(segment.Allocated() == 0);
+}
+
+}  // namespace
+
+int main() {
+    TestOffsetPtr();
+    TestTwoMappings();
+    TestAllocator();
+    TestFork();
+    return TestResult();
+}
@@ -0,0 +1,190 @@
+#include "check.h"
+
+#include "intrusive.h"
+
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct Object : ThreadSafeRefCounted<Object> {
+    static inline std::atomic<int> alive{0};
+    Object() {
+        ++alive;
+    }
+    Object(const Object& other) : ThreadSafeRefCounted<Object>(other) {
+        ++alive;
+    }
+    ~Object() {
+        --alive;
+    }
+    int value = 3;
+};
+
+struct Simple : SimpleRefCounted<Simple> {};
+
+struct Watched : WeakRefCounted<Watched> {
+    static inline std::atomic<int> alive{0};
+    Watched() {
+        ++alive;
+    }
+    ~Watched() {
+        --alive;
+    }
+    int value = 3;
+};
+
+struct Message : ThreadSafeRefCounted<Message, PooledDelete> {
+    static constexpr size_t kThrowingId = SIZE_MAX;
+    static inline std::atomic<int> alive{0};
+    explicit Message(size_t id) : id(id) {
+        if (id == kThrowingId) {
+            throw 1;
+        }
+        ++alive;
+    }
+    ~Message() {
+        --alive;
+    }
+    size_t id;
+};
+
+struct alignas(64) PooledWide : SimpleRefCounted<PooledWide, PooledDelete> {
+    char pad[200];
+};
+
+void TestCounting() {
+    {
+        auto p = MakeIntrusive<Object>();
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; ++t) {
+            threads.emplace_back([p] {
+                for (int i = 0; i < 10000; ++i) {
+                    IntrusivePtr<Object> copy(p);
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        CHECK(p.UseCount() == 1);
+        Object copy(*p);
+        CHECK(copy.RefCount() == 0);
+    }
+    CHECK(Object::alive == 0);
+
+    auto simple = MakeIntrusive<Simple>();
+    auto other = simple;
+    CHECK(simple.UseCount() == 2);
+    simple.Reset();
+    CHECK(!simple && other.UseCount() == 1);
+}
+
+void TestAdopt() {
+    auto p = MakeIntrusive<Object>();
+    Object* raw = p.Detach();
+    CHECK(!p && raw->RefCount() == 1);
+    IntrusivePtr<Object> adopted(raw, kAdoptRef);
+    CHECK(adopted.UseCount() == 1);
+    adopted.Reset();
+    CHECK(Object::alive == 0);
+}
+
+void TestWeak() {
+    {
+        auto p = MakeIntrusive<Watched>();
+        auto q = p;
+        IntrusiveWeakPtr<Watched> weak(p);
+        CHECK(weak.UseCount() == 2);
+        auto locked = weak.Lock();
+        CHECK(locked && locked->value == 3 && p.UseCount() == 3);
+        IntrusiveWeakPtr<Watched> copy = weak;
+        p.Reset();
+        q.Reset();
+        locked.Reset();
+        CHECK(Watched::alive == 0 && weak.Expired() && !copy.Lock());
+    }
+    for (int round = 0; round < 200; ++round) {
+        auto p = MakeIntrusive<Watched>();
+        std::vector<IntrusivePtr<Watched>> owners(3, p);
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 3; ++t) {
+            threads.emplace_back([&, t] {
+                IntrusiveWeakPtr<Watched> weak(owners[t]);
+                owners[t].Reset();
+                for (int i = 0; i < 20; ++i) {
+                    auto locked = weak.Lock();
+                    CHECK(!locked || locked->value == 3);
+                }
+            });
+        }
+        p.Reset();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+    CHECK(Watched::alive == 0);
+}
+
+void TestPooled() {
+    {
+        std::vector<IntrusivePtr<Message>> messages;
+        for (size_t i = 0; i < 1000; ++i) {
+            messages.push_back(MakeIntrusivePooled<Message>(i));
+        }
+        CHECK_THROWS(MakeIntrusivePooled<Message>(Message::kThrowingId), int);
+        auto wide = MakeIntrusivePooled<PooledWide>();
+        CHECK(reinterpret_cast<uintptr_t>(wide.Get()) % alignof(PooledWide) == 0);
+    }
+    CHECK(Message::alive == 0);
+
+    // Allocated on one thread, released on another
+    std::vector<IntrusivePtr<Message>> handoff;
+    std::mutex mutex;
+    std::thread producer([&] {
+        for (size_t i = 0; i < 20000; ++i) {
+            auto message = MakeIntrusivePooled<Message>(i);
+            std::lock_guard guard(mutex);
+            handoff.push_back(std::move(message));
+        }
+    });
+    std::thread consumer([&] {
+        for (size_t received = 0; received < 20000;) {
+            std::vector<IntrusivePtr<Message>> taken;
+            {
+                std::lock_guard guard(mutex);
+                taken.swap(handoff);
+            }
+            received += taken.size();
+        }
+    });
+    producer.join();
+    consumer.join();
+    CHECK(Message::alive == 0);
+
+    // Released and made by a thread_local destroyed after the thread's pool list
+    struct Late {
+        ~Late() {
+            message.Reset();
+            auto another = MakeIntrusivePooled<Message>(1);
+        }
+        IntrusivePtr<Message> message;
+    };
+    std::thread([] {
+        thread_local Late late;
+        late.message = MakeIntrusivePooled<Message>(0);
+    }).join();
+    CHECK(Message::alive == 0);
+}
+
+}  // namespace
+
+int main() {
+    TestCounting();
+    TestAdopt();
+    TestWeak();
+    TestPooled();
+    return TestResult();
+}
@@ -0,0 +1,76 @@
+#include "check.h"
+
+#include "compact_shared.h"
+#include "intrusive.h"
+#include "relocating_vector.h"
+#include "shared.h"
+#include "unique.h"
+
+#include <string>
+
+namespace {
+
+struct Node : SimpleRefCounted<Node> {};
+
+static_assert(kIsTriviallyRelocatable<SharedPtr<int>> && kIsTriviallyRelocatable<WeakPtr<int>>);
+static_assert(kIsTriviallyRelocatable<CompactSharedPtr<int>>);
+static_assert(kIsTriviallyRelocatable<IntrusivePtr<Node>>);
+static_assert(kIsTriviallyRelocatable<UniquePtr<int>> && kIsTriviallyRelocatable<UniquePtr<int[]>>);
+static_assert(!kIsTriviallyRelocatable<std::string>);
+
+static_assert(std::is_nothrow_move_constructible_v<SharedPtr<int>>);
+static_assert(std::is_nothrow_move_assignable_v<SharedPtr<int>>);
+static_assert(std::is_nothrow_move_constructible_v<WeakPtr<int>>);
+static_assert(std::is_nothrow_move_constructible_v<IntrusivePtr<Node>>);
+static_assert(std::is_nothrow_move_constructible_v<CompactSharedPtr<int>>);
+
+void TestRelocatable() {
+    auto shared = MakeShared<int>(5);
+    {
+        RelocatingVector<SharedPtr<int>> v;
+        // Enough to move from the heap to a mapping
+        for (int i = 0; i < 200000; ++i) {
+            v.PushBack(shared);
+        }
+        CHECK(shared.UseCount() == 200001);
+        for (int i = 0; i < 1000; ++i) {
+            v.PushBack(v[0]);
+        }
+        v.PopBack();
+        CHECK(v.Size() == 200999 && *v[200000] == 5);
+
+        RelocatingVector<SharedPtr<int>> moved(std::move(v));
+        CHECK(v.Empty() && moved.Size() == 200999);
+        moved.Clear();
+        CHECK(shared.UseCount() == 1);
+        moved.PushBack(shared);
+    }
+    CHECK(shared.UseCount() == 1);
+
+    RelocatingVector<UniquePtr<int>> owners;
+    owners.Reserve(10);
+    CHECK(owners.Capacity() >= 10);
+    for (int i = 0; i < 100; ++i) {
+        owners.EmplaceBack(new int(i));
+    }
+    CHECK(*owners[99] == 99);
+}
+
+void TestOtherTypes() {
+    RelocatingVector<std::string> strings;
+    for (int i = 0; i < 10000; ++i) {
+        strings.EmplaceBack(std::to_string(i) + std::string(20, 'x'));
+    }
+    for (int i = 0; i < 100; ++i) {
+        strings.PushBack(strings[0]);
+    }
+    CHECK(strings[9999].substr(0, 4) == "9999" && strings[10050] == strings[0]);
+}
+
+}  // namespace
+
+int main() {
+    TestRelocatable();
+    TestOtherTypes();
+    return TestResult();
+}
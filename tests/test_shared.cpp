@@ -0,0 +1,346 @@
+#include "check.h"
+
+#include "shared.h"
+#include "unique.h"
+#include "weak.h"
+
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct Counted {
+    static inline std::atomic<int> alive{0};
+    Counted() {
+        ++alive;
+    }
+    Counted(const Counted&) {
+        ++alive;
+    }
+    ~Counted() {
+        --alive;
+    }
+    int value = 7;
+};
+
+struct Conn : EnableSharedFromThis<Conn>, Counted {};
+struct DerivedConn : Conn {};
+
+struct Base {
+    virtual ~Base() = default;
+    int base = 1;
+};
+struct Derived : Base {
+    int derived = 2;
+};
+
+int closed = 0;
+struct CountingClose {
+    void operator()(int* ptr) const {
+        ++closed;
+        delete ptr;
+    }
+};
+struct MoveOnlyClose : CountingClose {
+    MoveOnlyClose() = default;
+    MoveOnlyClose(MoveOnlyClose&&) = default;
+    MoveOnlyClose(const MoveOnlyClose&) = delete;
+};
+
+struct Thrower {
+    static inline int built = 0;
+    static inline int alive = 0;
+    Thrower() {
+        if (built++ == 5) {
+            throw 1;
+        }
+        ++alive;
+    }
+    ~Thrower() {
+        --alive;
+    }
+};
+
+struct alignas(128) Wide {
+    char bytes[128];
+};
+
+void TestBasics() {
+    auto p = MakeShared<int>(5);
+    auto q = p;
+    CHECK(*q == 5 && p.UseCount() == 2);
+    q.Reset();
+    CHECK(!q && p.UseCount() == 1);
+
+    SharedPtr<int> empty;
+    SharedPtr<int> null(nullptr);
+    CHECK(!empty && !null && empty.UseCount() == 0);
+
+    SharedPtr<int> moved(std::move(p));
+    CHECK(!p && *moved == 5 && moved.UseCount() == 1);
+
+    SharedPtr<Base> base = MakeShared<Derived>();
+    CHECK(base->base == 1);
+    SharedPtr<int> alias(base, &base->base);
+    CHECK(base.UseCount() == 2 && *alias == 1);
+
+    {
+        SharedPtr<Counted> owner(new Counted);
+        auto copy = owner;
+        CHECK(Counted::alive == 1);
+    }
+    CHECK(Counted::alive == 0);
+}
+
+void TestDeleters() {
+    closed = 0;
+    {
+        SharedPtr<int> p(new int(1), CountingClose{});
+        auto q = p;
+    }
+    CHECK(closed == 1);
+
+    int calls = 0;
+    {
+        SharedPtr<int> p(new int(1), [&calls](int* ptr) {
+            ++calls;
+            delete ptr;
+        });
+        WeakPtr<int> w(p);
+        p.Reset();
+        CHECK(calls == 1 && w.Expired());
+    }
+
+    {
+        UniquePtr<int, CountingClose> unique(new int(5));
+        SharedPtr<int> shared(std::move(unique));
+        CHECK(!unique.Get() && *shared == 5);
+    }
+    CHECK(closed == 2);
+    {
+        UniquePtr<int, MoveOnlyClose> unique(new int(6));
+        SharedPtr<int> shared(std::move(unique));
+        UniquePtr<int, MoveOnlyClose> empty;
+        CHECK(*shared == 6 && !SharedPtr<int>(std::move(empty)));
+    }
+    CHECK(closed == 3);
+
+    static_assert(sizeof(ControlBlockDeleter<int, CountingClose>) ==
+                  sizeof(ControlBlockPointer<int>));
+
+    auto allocated = AllocateShared<std::vector<int>>(std::allocator<int>(), 3, 7);
+    CHECK((*allocated)[2] == 7);
+}
+
+void TestPolicies() {
+    auto single = MakeShared<Counted, CountPolicy::kSingleThreaded>();
+    auto single_copy = single;
+    CHECK(single.UseCount() == 2);
+
+    for (int round = 0; round < 50; ++round) {
+        auto p = MakeShared<Counted, CountPolicy::kBiased>();
+        WeakPtr<Counted> w(p);
+        std::vector<SharedPtr<Counted>> copies(4, p);
+        std::vector<std::thread> threads;
+        for (auto& copy : copies) {
+            threads.emplace_back([copy = std::move(copy), w]() mutable {
+                for (int i = 0; i < 100; ++i) {
+                    auto again = copy;
+                    auto locked = w.Lock();
+                    CHECK(!locked || locked->value == 7);
+                }
+                copy.Reset();
+            });
+        }
+        p.Reset();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        DrainBiasedQueue();
+        CHECK(w.Expired());
+    }
+    single.Reset();
+    single_copy.Reset();
+    CHECK(Counted::alive == 0);
+
+    // The creating thread exits while others still own the object
+    SharedPtr<Counted> keep;
+    std::thread([&] { keep = MakeShared<Counted, CountPolicy::kBiased>(); }).join();
+    CHECK(Counted::alive == 1);
+    keep.Reset();
+    CHECK(Counted::alive == 0);
+}
+
+void TestSharded() {
+    {
+        auto p = MakeSharedSharded<Counted>();
+        static_assert(alignof(ShardedControlBlockBase) == kCacheLineSize);
+        auto q = p;
+        WeakPtr<Counted> w(q);
+        CHECK(p.UseCount() == 2 && w.Lock()->value == 7);
+        p.Reset();
+        q.Reset();
+        CHECK(w.Expired() && !w.Lock() && Counted::alive == 0);
+    }
+
+    for (int round = 0; round < 20; ++round) {
+        auto p = MakeSharedSharded<Counted>();
+        WeakPtr<Counted> w(p);
+        std::vector<SharedPtr<Counted>> handed(8, p);  // counted in this thread's slot
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 8; ++t) {
+            threads.emplace_back([&, t, mine = std::move(handed[t])]() mutable {
+                for (int i = 0; i < 1000; ++i) {
+                    auto copy = mine;
+                    auto locked = w.Lock();
+                    CHECK(locked && locked->value == 7);
+                }
+                if (t == round % 8) {
+                    p.Reset();  // the direct reference goes away while the others are busy
+                }
+                mine.Reset();  // dropped from a slot that never counted it
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        CHECK(w.Expired() && Counted::alive == 0);
+    }
+
+    // Alive after the collapse, counted directly from then on
+    auto p = MakeSharedSharded<Counted>();
+    SharedPtr<Counted> copy;
+    std::thread([&] { copy = p; }).join();
+    p.Reset();
+    auto again = copy;
+    CHECK(copy.UseCount() == 2 && Counted::alive == 1);
+    copy.Reset();
+    again.Reset();
+    CHECK(Counted::alive == 0);
+
+    auto array = MakeShared<int[], CountPolicy::kSharded>(100);
+    CHECK(array.Size() == 100 && array[99] == 0);
+}
+
+void TestSharedFromThis() {
+    {
+        auto p = MakeShared<Conn>();
+        auto self = p->SharedFromThis();
+        CHECK(self.Get() == p.Get() && p.UseCount() == 2);
+        WeakPtr<Conn> weak = p->WeakFromThis();
+        CHECK(!weak.Expired());
+
+        const Conn& ref = *p;
+        SharedPtr<const Conn> const_self = ref.SharedFromThis();
+        CHECK(p.UseCount() == 3);
+
+        Conn copy(*p);  // a copy is not owned by anybody
+        CHECK(!copy.SharedFromThis());
+    }
+    {
+        SharedPtr<DerivedConn> derived(new DerivedConn);
+        SharedPtr<Conn> base = derived->SharedFromThis();
+        CHECK(derived.UseCount() == 2);
+
+        SharedPtr<Conn> with_deleter(new Conn, [](Conn* conn) { delete conn; });
+        CHECK(with_deleter->SharedFromThis().UseCount() == 2);
+    }
+    WeakPtr<Conn> weak;
+    {
+        auto p = MakeShared<Conn>();
+        weak = p->WeakFromThis();
+    }
+    CHECK(weak.Expired());
+    CHECK(Counted::alive == 0);
+}
+
+void TestArrays() {
+    auto a = MakeShared<double[]>(1000);
+    CHECK(a.Size() == 1000 && a[999] == 0.0);
+    CHECK(reinterpret_cast<uintptr_t>(a.Get()) % kCacheLineSize == 0);
+    a[3] = 1.5;
+    SharedPtr<const double[]> c = a;
+    CHECK(c[3] == 1.5 && c.Size() == 1000);
+
+    auto fixed = MakeShared<std::string[4]>();
+    static_assert(sizeof(fixed) == 2 * sizeof(void*));
+    fixed[2] = std::string(100, 'x');
+    CHECK(fixed.Size() == 4);
+
+    auto overwrite = MakeSharedForOverwrite<int[]>(1 << 16);
+    CHECK(overwrite.Size() == 1 << 16);
+    CHECK(MakeShared<int[]>(0).Size() == 0);
+    CHECK((MakeShared<int[], CountPolicy::kBiased>(10)[9] == 0));
+
+    auto wide = MakeShared<Wide[]>(3);
+    CHECK(reinterpret_cast<uintptr_t>(wide.Get()) % alignof(Wide) == 0);
+
+    CHECK_THROWS(MakeShared<Thrower[]>(10), int);
+    CHECK(Thrower::alive == 0);
+    CHECK_THROWS(MakeShared<int[]>(SIZE_MAX / 2), std::bad_array_new_length);
+}
+
+void TestThreads() {
+    std::vector<SharedPtr<int>> made;
+    for (int i = 0; i < 10000; ++i) {
+        made.push_back(MakeShared<int>(i));
+    }
+    // Blocks from the pool freed on another thread
+    std::thread([&] { made.clear(); }).join();
+
+    // Blocks freed and made by a thread_local destroyed after the thread's pool was parked
+    struct Late {
+        ~Late() {
+            shared.Reset();
+            for (int i = 0; i < 1000; ++i) {
+                made.push_back(MakeShared<int>(i));
+            }
+            made.erase(made.begin(), made.end() - 1);
+            shared = MakeShared<int>(2);
+            made.push_back(shared);
+        }
+        SharedPtr<int> shared;
+        std::vector<SharedPtr<int>>& made;
+    };
+    std::thread([&] {
+        thread_local Late late{nullptr, made};
+        late.shared = MakeShared<int>(1);
+    }).join();
+    CHECK(made.size() == 2 && *made[0] == 999 && *made[1] == 2 && made[1].UseCount() == 1);
+    made.clear();
+
+    for (int round = 0; round < 50; ++round) {
+        auto shared = MakeShared<std::vector<int>>(10, 1);
+        WeakPtr<std::vector<int>> weak(shared);
+        std::vector<std::thread> threads;
+        for (int i = 0; i < 4; ++i) {
+            threads.emplace_back([shared, weak] {
+                for (int k = 0; k < 1000; ++k) {
+                    auto copy = shared;
+                    auto locked = weak.Lock();
+                    CHECK(locked && (*locked)[9] == 1);
+                }
+            });
+        }
+        shared.Reset();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        CHECK(weak.Expired());
+    }
+}
+
+}  // namespace
+
+int main() {
+    TestBasics();
+    TestDeleters();
+    TestPolicies();
+    TestSharded();
+    TestSharedFromThis();
+    TestArrays();
+    TestThreads();
+    return TestResult();
+}
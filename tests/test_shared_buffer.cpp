@@ -0,0 +1,136 @@
+#include "check.h"
+
+#include "shared_buffer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+
+namespace {
+
+SharedBuffer FromString(const std::string& text) {
+    return SharedBuffer(text.data(), text.size());
+}
+
+std::string ToString(const SharedBuffer& buffer) {
+    return std::string(reinterpret_cast<const char*>(buffer.Data()), buffer.Size());
+}
+
+std::string ToString(const SharedBufferChain& chain) {
+    return ToString(chain.Flatten());
+}
+
+void TestSlicing() {
+    auto packet = FromString("HEADER|payload|TRAILER");
+    auto header = packet.Slice(0, 6);
+    auto payload = packet.Slice(7, 7);
+    auto rest = packet.Slice(15);
+    CHECK(ToString(header) == "HEADER" && ToString(payload) == "payload" &&
+          ToString(rest) == "TRAILER");
+    // No copies: the same bytes, one allocation
+    CHECK(payload.Data() == packet.Data() + 7 && packet.UseCount() == 4);
+
+    CHECK(packet.Slice(packet.Size()).Empty() && packet.Slice(3, 0).Empty());
+    CHECK_THROWS(packet.Slice(packet.Size() + 1), std::out_of_range);
+
+    auto taken = packet.TakePrefix(7);
+    CHECK(ToString(taken) == "HEADER|" && ToString(packet) == "payload|TRAILER");
+    packet.RemoveSuffix(8);
+    CHECK(ToString(packet) == "payload" && packet.UseCount() == 5);
+    packet.RemovePrefix(100);
+    CHECK(packet.Empty() && payload.UseCount() == 4);
+
+    SharedBuffer empty(0);
+    CHECK(empty.Empty() && empty.Data() == nullptr && empty.UseCount() == 0);
+}
+
+void TestCopyOnWrite() {
+    auto packet = FromString("abcdef");
+    auto slice = packet.Slice(2, 2);
+    const std::byte* shared = slice.Data();
+
+    // Shared: the slice gets bytes of its own, the packet is left alone
+    slice.MutableData()[0] = std::byte{'X'};
+    CHECK(slice.Data() != shared && ToString(slice) == "Xd" && ToString(packet) == "abcdef");
+    CHECK(slice.UseCount() == 1 && packet.UseCount() == 1);
+
+    // Alone: written in place, even though it is a window into a larger allocation
+    auto window = packet.Slice(1, 3);
+    packet = SharedBuffer();
+    const std::byte* before = window.Data();
+    window.MutableData()[0] = std::byte{'B'};
+    CHECK(window.Data() == before && ToString(window) == "Bcd");
+}
+
+void TestChain() {
+    SharedBufferChain chain;
+    chain.Append(FromString("one,"));
+    chain.Append(FromString("two,"));
+    chain.Append(SharedBuffer());
+    chain.Append(FromString("three"));
+    CHECK(chain.Size() == 13 && chain.Count() == 3 && ToString(chain) == "one,two,three");
+
+    // Cuts "two," in two and shares its bytes
+    auto prefix = chain.TakePrefix(6);
+    CHECK(ToString(prefix) == "one,tw" && ToString(chain) == "o,three");
+    CHECK(prefix.Count() == 2 && chain.Count() == 2 && prefix[1].UseCount() == 2);
+
+    iovec iovecs[4];
+    CHECK(chain.FillIovecs(iovecs, 4) == 2 && iovecs[0].iov_len == 2 && iovecs[1].iov_len == 5);
+    CHECK(chain.FillIovecs(iovecs, 1) == 1);
+    CHECK(chain.Flatten().Data() != chain[0].Data());
+
+    prefix.Append(std::move(chain));
+    CHECK(chain.Empty() && ToString(prefix) == "one,two,three");
+    prefix.RemovePrefix(5);
+    CHECK(ToString(prefix) == "wo,three" && prefix.Count() == 3);
+    prefix.Append(std::move(prefix));
+    CHECK(ToString(prefix) == "wo,three" && prefix.Count() == 3);
+    CHECK(prefix.TakePrefix(100).Size() == 8 && prefix.Empty() && prefix.Count() == 0);
+}
+
+void TestSendQueue() {
+    // Appended to while partial writes drain it, never empty
+    SharedBufferChain queue;
+    auto message = FromString("0123456789");
+    queue.Append(message);
+    size_t max_slots = 0;
+    for (int round = 0; round < 10000; ++round) {
+        for (int i = 0; i < 3; ++i) {
+            queue.Append(message);
+        }
+        queue.RemovePrefix(round % 2 ? 27 : 33);
+        max_slots = std::max(max_slots, queue.Slots());
+    }
+    CHECK(queue.Size() == 10 && max_slots <= 8);
+    CHECK(ToString(queue) == "0123456789" && message.UseCount() == 2);
+}
+
+void TestWriteTo() {
+    int fds[2];
+    CHECK(pipe(fds) == 0);
+    SharedBufferChain chain;
+    auto message = FromString("header:body");
+    chain.Append(message.Slice(7));
+    chain.Append(FromString("|"));
+    chain.Append(message.Slice(0, 6));
+    CHECK(chain.WriteTo(fds[1]) == 11 && chain.Empty());
+
+    char received[16] = {};
+    CHECK(read(fds[0], received, sizeof(received)) == 11);
+    CHECK(std::string(received) == "body|header");
+    close(fds[0]);
+    close(fds[1]);
+}
+
+}  // namespace
+
+int main() {
+    TestSlicing();
+    TestCopyOnWrite();
+    TestChain();
+    TestSendQueue();
+    TestWriteTo();
+    return TestResult();
+}
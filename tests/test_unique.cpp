@@ -0,0 +1,134 @@
+#include "check.h"
+
+#include "arena.h"
+#include "unique.h"
+
+#include <cstdint>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+
+namespace {
+
+struct Counted {
+    static inline int alive = 0;
+    explicit Counted(std::string text = "") : text(std::move(text)) {
+        ++alive;
+    }
+    ~Counted() {
+        --alive;
+    }
+    std::string text;
+};
+
+struct Base {
+    virtual ~Base() = default;
+};
+struct Derived : Base {};
+
+struct Thrower {
+    static inline int budget = 100;
+    static inline int alive = 0;
+    Thrower() {
+        if (--budget == 0) {
+            throw 1;
+        }
+        ++alive;
+    }
+    ~Thrower() {
+        --alive;
+    }
+};
+
+struct alignas(64) Wide {
+    int value = 1;
+};
+
+void TestSingle() {
+    {
+        UniquePtr<Counted> p(new Counted("a"));
+        CHECK(p->text == "a" && Counted::alive == 1);
+        UniquePtr<Counted> q(std::move(p));
+        CHECK(!p && q);
+        p = std::move(q);
+        CHECK(p && !q);
+        Counted* raw = p.Release();
+        CHECK(!p);
+        p.Reset(raw);
+        p = nullptr;
+        CHECK(Counted::alive == 0);
+    }
+    UniquePtr<Base> upcast(UniquePtr<Derived>(new Derived));
+    CHECK(upcast);
+}
+
+void TestArray() {
+    UniquePtr<int[]> plain(new int[4]{1, 2, 3, 4}, 4);
+    UniquePtr<int[]> moved(std::move(plain));
+    CHECK(!plain && plain.Size() == 0 && moved.Size() == 4 && moved[3] == 4);
+    CHECK(std::accumulate(moved.begin(), moved.end(), 0) == 10);
+    moved = nullptr;
+    CHECK(!moved);
+
+    UniquePtr<int[]> no_length(new int[2]);
+    CHECK(no_length.Size() == 0);
+}
+
+void TestAligned() {
+    auto floats = MakeUniqueAligned<float[]>(1000);
+    CHECK(reinterpret_cast<uintptr_t>(floats.Get()) % kSimdAlignment == 0);
+    CHECK(floats.Size() == 1000 && floats[999] == 0.f);
+    std::iota(floats.begin(), floats.end(), 0.f);
+    auto other = std::move(floats);
+    CHECK(!floats && other[10] == 10.f);
+
+    auto page = MakeUniqueForOverwrite<double[]>(3, 4096);
+    CHECK(reinterpret_cast<uintptr_t>(page.Get()) % 4096 == 0);
+    auto huge =
+        MakeUniqueForOverwrite<char[]>(kHugePageSize * 2, kSimdAlignment, HugePages::kAdvise);
+    CHECK(reinterpret_cast<uintptr_t>(huge.Get()) % kHugePageSize == 0);
+
+    {
+        auto strings = MakeUniqueAligned<std::string[]>(5);
+        strings[4] = std::string(100, 'x');
+    }
+    CHECK_THROWS(MakeUniqueAligned<Thrower[]>(200), int);
+    CHECK(Thrower::alive == 0);
+    CHECK_THROWS(MakeUniqueAligned<int[]>(1, 48), std::invalid_argument);
+    CHECK_THROWS(MakeUniqueAligned<int[]>(SIZE_MAX / 2), std::bad_array_new_length);
+    auto empty = MakeUniqueAligned<int[]>(0);
+    CHECK(empty && empty.begin() == empty.end());
+}
+
+void TestArena() {
+    static_assert(sizeof(UniquePtr<Counted, ArenaDelete>) == sizeof(Counted*));
+    Arena arena;
+    {
+        auto counted = MakeUniqueIn<Counted>(arena, std::string(100, 'a'));
+        auto number = MakeUniqueIn<int>(arena, 5);
+        auto wide = MakeUniqueIn<Wide>(arena);
+        CHECK(reinterpret_cast<uintptr_t>(wide.Get()) % alignof(Wide) == 0);
+        CHECK(*number == 5 && counted->text.size() == 100 && Counted::alive == 1);
+        for (int i = 0; i < 10000; ++i) {
+            MakeUniqueIn<Counted>(arena, "x");
+        }
+        CHECK(arena.Allocate(Arena::kMaxBlockSize * 2, 16) != nullptr);
+    }
+    CHECK(Counted::alive == 0);
+    CHECK(arena.BytesReserved() > Arena::kMaxBlockSize * 2);
+    arena.Release();
+    CHECK(arena.BytesReserved() == 0);
+    void* empty = arena.Allocate(0, 1);
+    CHECK(empty != nullptr && arena.Allocate(0, 1) != empty);
+    CHECK(*MakeUniqueIn<int>(arena, 7) == 7);
+}
+
+}  // namespace
+
+int main() {
+    TestSingle();
+    TestArray();
+    TestAligned();
+    TestArena();
+    return TestResult();
+}
@@ -0,0 +1,114 @@
+#include "check.h"
+
+#include "shared.h"
+#include "weak.h"
+
+#include <vector>
+
+namespace {
+
+struct Base {
+    int base = 1;
+};
+struct Derived : Base {};
+
+void TestLock() {
+    auto p = MakeShared<int>(5);
+    WeakPtr<int> w(p);
+    CHECK(!w.Expired() && w.UseCount() == 1);
+    auto locked = w.Lock();
+    CHECK(locked && *locked == 5 && p.UseCount() == 2);
+
+    WeakPtr<int> copy = w;
+    WeakPtr<int> moved(std::move(copy));
+    CHECK(!copy.Lock() && moved.Lock().Get() == p.Get());
+
+    p.Reset();
+    locked.Reset();
+    CHECK(w.Expired() && moved.Expired());
+    CHECK(!w.Lock());
+    CHECK_THROWS(SharedPtr<int>{w}, BadWeakPtr);
+
+    WeakPtr<int> empty;
+    CHECK(empty.Expired() && !empty.Lock());
+    static_assert(noexcept(empty.Lock()));
+
+    for (CountPolicy policy : {CountPolicy::kBiased, CountPolicy::kSharded}) {
+        auto other = policy == CountPolicy::kBiased ? MakeShared<int, CountPolicy::kBiased>(6)
+                                                    : MakeSharedSharded<int>(6);
+        WeakPtr<int> weak(other);
+        CHECK(*weak.Lock() == 6 && other.UseCount() == 2);  // and the temporary
+        CHECK(other.UseCount() == 1);
+        other.Reset();
+        CHECK(!weak.Lock());
+    }
+}
+
+struct Observer : EnableSharedFromThis<Observer> {
+    explicit Observer(int id) : id(id){};
+    int id;
+};
+
+void TestLockAll() {
+    std::vector<SharedPtr<Observer>> alive;
+    std::vector<WeakPtr<Observer>> observers;
+    for (int i = 0; i < 100; ++i) {
+        auto observer = MakeShared<Observer>(i);
+        observers.emplace_back(observer);
+        if (i % 3 != 0) {
+            alive.push_back(observer);
+        }
+    }
+    observers.emplace_back();
+
+    auto locked = LockAll(observers);
+    CHECK(locked.size() == alive.size());
+    bool same = true;
+    for (size_t i = 0; i < locked.size(); ++i) {
+        same = same && locked[i] == alive[i] && locked[i]->SharedFromThis() == alive[i];
+    }
+    CHECK(same && alive[0].UseCount() == 2);
+
+    // Appends, for a buffer reused from event to event
+    CHECK(LockAll(observers.data(), 3, locked) == 2 && locked.size() == alive.size() + 2);
+#if __cplusplus >= 202002L
+    CHECK(LockAll(std::span<const WeakPtr<Observer>>(observers)).size() == alive.size());
+#endif
+    alive.clear();
+    locked.clear();
+    CHECK(LockAll(observers).empty());
+}
+
+void TestConversions() {
+    auto derived = MakeShared<Derived>();
+    WeakPtr<Base> from_shared(derived);
+    WeakPtr<Derived> weak_derived(derived);
+    WeakPtr<Base> from_weak(weak_derived);
+    CHECK(from_shared.Lock()->base == 1 && from_weak.Lock().Get() == derived.Get());
+
+    WeakPtr<const Derived> to_const(derived);
+    CHECK(to_const.UseCount() == 1);
+}
+
+void TestAssignment() {
+    auto a = MakeShared<int>(1);
+    auto b = MakeShared<int>(2);
+    WeakPtr<int> w(a);
+    w = WeakPtr<int>(b);
+    CHECK(*w.Lock() == 2);
+    WeakPtr<int>& same = w;
+    w = same;
+    CHECK(*w.Lock() == 2);
+    b.Reset();
+    CHECK(w.Expired());
+}
+
+}  // namespace
+
+int main() {
+    TestLock();
+    TestLockAll();
+    TestConversions();
+    TestAssignment();
+    return TestResult();
+}
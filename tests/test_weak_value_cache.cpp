@@ -0,0 +1,172 @@
+#include "check.h"
+
+#include "weak_value_cache.h"
+
+#include <map>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+namespace {
+
+struct Schema {
+    static inline std::atomic<int> alive{0};
+    explicit Schema(std::string name) : name(std::move(name)) {
+        ++alive;
+    }
+    Schema(const Schema& other) : name(other.name) {
+        ++alive;
+    }
+    ~Schema() {
+        --alive;
+    }
+    std::string name;
+};
+
+void TestInterning() {
+    WeakValueCache<std::string, const Schema> cache;
+    int made = 0;
+    auto make = [&] {
+        ++made;
+        return Schema("users");
+    };
+
+    auto first = cache.GetOrCreate("users", make);
+    auto second = cache.GetOrCreate("users", make);
+    CHECK(first == second && made == 1 && first->name == "users" && first.UseCount() == 2);
+    CHECK(cache.Get("users") == first && !cache.Get("orders") && cache.Size() == 1);
+
+    // The cache holds no strong reference, the entry goes with the last owner
+    first.Reset();
+    second.Reset();
+    CHECK(Schema::alive == 0 && cache.Size() == 0 && !cache.Get("users"));
+    auto third = cache.GetOrCreate("users", make);
+    CHECK(made == 2 && third->name == "users");
+
+    auto stats = cache.Stats();
+    CHECK(stats.hits == 1 && stats.misses == 2 && stats.evictions == 1);
+}
+
+void TestFactoryThrows() {
+    WeakValueCache<int, Schema> cache(4);
+    CHECK(cache.ShardCount() == 4);
+    CHECK_THROWS(cache.GetOrCreate(1, []() -> Schema { throw std::runtime_error("bad"); }),
+                 std::runtime_error);
+    CHECK(cache.Size() == 0 && Schema::alive == 0);
+    CHECK(cache.GetOrCreate(1, [] { return Schema("one"); })->name == "one");
+}
+
+// Its destructor asks for its own key again, while the old entry is still in the map but dead
+SharedPtr<struct Phoenix> reborn;
+WeakValueCache<int, Phoenix>* phoenix_cache = nullptr;
+
+struct Phoenix {
+    explicit Phoenix(bool again) : again(again){};
+    ~Phoenix() {
+        if (again) {
+            reborn = phoenix_cache->GetOrCreate(7, [] { return Phoenix(false); });
+        }
+    }
+    Phoenix(Phoenix&& other) : again(other.again) {
+        other.again = false;
+    }
+    bool again;
+};
+
+void TestDyingEntryIsReplaced() {
+    WeakValueCache<int, Phoenix> cache;
+    phoenix_cache = &cache;
+    cache.GetOrCreate(7, [] { return Phoenix(true); }).Reset();
+
+    // The late hook of the first block must not erase the second one
+    CHECK(reborn && cache.Size() == 1 && cache.Get(7) == reborn);
+    reborn.Reset();
+    CHECK(cache.Size() == 0);
+    auto stats = cache.Stats();
+    CHECK(stats.misses == 2 && stats.evictions == 1);
+}
+
+void TestValuesOutliveCache() {
+    SharedPtr<Schema> kept;
+    {
+        WeakValueCache<int, Schema> cache;
+        kept = cache.GetOrCreate(1, [] { return Schema("kept"); });
+        cache.GetOrCreate(2, [] { return Schema("dropped"); });
+    }
+    CHECK(kept->name == "kept" && Schema::alive == 1);
+    kept.Reset();
+    CHECK(Schema::alive == 0);
+}
+
+void TestThreads() {
+    constexpr int kThreads = 4;
+    constexpr int kKeys = 64;
+    constexpr int kRounds = 2000;
+    WeakValueCache<int, Schema> cache(8);
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; ++t) {
+        threads.emplace_back([&, t] {
+            std::vector<SharedPtr<Schema>> held(kKeys);
+            for (int i = 0; i < kRounds; ++i) {
+                int key = (i * 7 + t) % kKeys;
+                held[key] = cache.GetOrCreate(key, [&] { return Schema(std::to_string(key)); });
+                if (i % 3 == 0) {
+                    held[(key + 1) % kKeys].Reset();
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    auto stats = cache.Stats();
+    CHECK(stats.hits + stats.misses == size_t(kThreads * kRounds));
+    CHECK(cache.Size() == 0 && Schema::alive == 0 && stats.evictions == stats.misses);
+}
+
+struct Pair {
+    int first = 1;
+    int second = 2;
+};
+
+void TestOwnerOrder() {
+    auto pair = MakeShared<Pair>();
+    SharedPtr<int> member(pair, &pair->second);
+    WeakPtr<Pair> weak(pair);
+    auto other = MakeShared<Pair>();
+
+    CHECK(OwnerEqual()(pair, member) && OwnerEqual()(member, weak) && !OwnerEqual()(pair, other));
+    CHECK(OwnerHash()(member) == OwnerHash()(weak));
+    CHECK(!OwnerLess()(pair, weak) && !OwnerLess()(weak, member));
+    CHECK(OwnerLess()(pair, other) != OwnerLess()(other, pair));
+
+    std::set<WeakPtr<Pair>, OwnerLess> ordered{weak, WeakPtr<Pair>(other)};
+    std::unordered_set<WeakPtr<Pair>, OwnerHash, OwnerEqual> hashed{weak, WeakPtr<Pair>(other)};
+    CHECK(ordered.size() == 2 && hashed.size() == 2);
+    // Heterogeneous lookup, and an expired entry stays where it was
+    CHECK(ordered.count(member) == 1);
+    other.Reset();
+    CHECK(ordered.count(WeakPtr<Pair>(weak)) == 1 && hashed.count(weak) == 1);
+
+    std::map<WeakPtr<Pair>, int, OwnerLess> by_owner;
+    by_owner[weak] = 1;
+    by_owner[WeakPtr<Pair>(pair)] = 2;
+    CHECK(by_owner.size() == 1 && by_owner.begin()->second == 2);
+}
+
+}  // namespace
+
+int main() {
+    TestInterning();
+    TestFactoryThrows();
+    TestDyingEntryIsReplaced();
+    TestValuesOutliveCache();
+    TestThreads();
+    TestOwnerOrder();
+    return TestResult();
+}
@@ -1,23 +1,24 @@
 #pragma once
 
 #include "compressed_pair.h"
+#include "default_delete.h"
+#include "relocatable.h"
 
 #include <cstddef>  // std::nullptr_t
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <stdexcept>
 #include <type_traits>
+#include <utility>
 
-template <typename T>
-struct DefaultDelete {
-    void operator()(T* ptr) const {
-        delete ptr;
-    }
-};
-
-template <typename T>
-struct DefaultDelete<T[]> {
-    void operator()(T* ptr) const {
-        delete[] ptr;
-    }
-};
+#if __cplusplus >= 202002L
+#include <span>
+#endif
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
 
 // Primary template
 template <typename T, typename Deleter = DefaultDelete<T>>
@@ -37,7 +38,7 @@ public:
     };
 
     template <typename Another, typename AnotherDeleter>  // upcast constructor
-    UniquePtr(UniquePtr<Another, AnotherDeleter>&& other) {
+    UniquePtr(UniquePtr<Another, AnotherDeleter>&& other) noexcept {
         data_pair_.GetFirst() = other.data_pair_.GetFirst();
         other.data_pair_.GetFirst() = nullptr;
     };
@@ -195,44 +196,224 @@ public:
     CompressedPair<T*, DefaultDelete<T[]>> data_pair_;
 };
 
+// Owning array that remembers its length. A deleter that takes (T*, size_t) is handed the length
+// too, which is how AlignedDelete destroys the elements of a MakeUniqueAligned buffer.
 template <typename T, typename Deleter>
 class UniquePtr<T[], Deleter> {
 public:
-    UniquePtr(T* ptr) {
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    explicit UniquePtr(T* ptr = nullptr, size_t size = 0) : size_(size) {
         data_pair_.GetFirst() = ptr;
     };
-    UniquePtr(T* ptr, Deleter deleter) : data_pair_(ptr, deleter){};
+    UniquePtr(T* ptr, Deleter deleter) : data_pair_(ptr, deleter) {
+        static_assert(!std::is_invocable_v<Deleter&, T*, size_t>,
+                      "a deleter that takes the length needs UniquePtr(ptr, size, deleter)");
+    };
+    UniquePtr(T* ptr, size_t size, Deleter deleter) : data_pair_(ptr, deleter), size_(size){};
+
+    UniquePtr(UniquePtr&& other) noexcept
+        : data_pair_(other.data_pair_.GetFirst(), std::move(other.data_pair_.GetSecond())),
+          size_(other.size_) {
+        other.data_pair_.GetFirst() = nullptr;
+        other.size_ = 0;
+    };
+
+    UniquePtr(const UniquePtr&) = delete;
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // `operator=`-s
+
+    UniquePtr& operator=(UniquePtr&& other) noexcept {
+        if (&other != this) {
+            Reset();
+            Swap(other);
+        }
+        return *this;
+    };
+    UniquePtr& operator=(std::nullptr_t) {
+        Reset();
+        return *this;
+    };
+
+    UniquePtr& operator=(const UniquePtr&) = delete;
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Destructor
 
     ~UniquePtr() {
         Reset();
     };
 
-    void Reset(T* ptr = nullptr) {
-        std::swap(data_pair_.GetFirst(), ptr);
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Modifiers
 
-        if (ptr != nullptr) {
-            data_pair_.GetSecond()(ptr);
-        }
+    T* Release() {
+        size_ = 0;
+        return std::exchange(data_pair_.GetFirst(), nullptr);
     };
-    void Reset(T* ptr = nullptr) const {
+    void Reset(T* ptr = nullptr, size_t size = 0) {
         std::swap(data_pair_.GetFirst(), ptr);
+        std::swap(size_, size);
 
         if (ptr != nullptr) {
-            data_pair_.GetSecond()(ptr);
+            if constexpr (std::is_invocable_v<Deleter&, T*, size_t>) {
+                data_pair_.GetSecond()(ptr, size);
+            } else {
+                data_pair_.GetSecond()(ptr);
+            }
         }
     };
-
-    T* Get() {
-        return data_pair_.GetFirst();
+    void Swap(UniquePtr& other) {
+        std::swap(other.data_pair_, data_pair_);
+        std::swap(other.size_, size_);
     };
 
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
     T* Get() const {
         return data_pair_.GetFirst();
     };
+    T* Data() const {
+        return data_pair_.GetFirst();
+    };
+    // 0 when the array was handed over without a length.
+    size_t Size() const {
+        return size_;
+    };
+    Deleter& GetDeleter() {
+        return data_pair_.GetSecond();
+    };
+    const Deleter& GetDeleter() const {
+        return data_pair_.GetSecond();
+    };
+    explicit operator bool() const {
+        return data_pair_.GetFirst() != nullptr;
+    };
 
-    T& operator[](size_t idx) {
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Element access
+
+    T& operator[](size_t idx) const {
         return Get()[idx];
-    }
+    };
+
+    T* begin() const {
+        return Get();
+    };
+    T* end() const {
+        return Get() + size_;
+    };
 
+#if __cplusplus >= 202002L
+    std::span<T> Span() const {
+        return {Get(), size_};
+    };
+#endif
+
+    // private:
     CompressedPair<T*, Deleter> data_pair_;
+    size_t size_ = 0;
+};
+
+// The pointer never points back at the UniquePtr, so it relocates whenever its deleter does.
+template <typename T, typename Deleter>
+struct IsTriviallyRelocatable<UniquePtr<T, Deleter>> : IsTriviallyRelocatable<Deleter> {};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Aligned arrays
+
+inline constexpr size_t kSimdAlignment = 64;
+inline constexpr size_t kHugePageSize = size_t(2) << 20;
+
+enum class HugePages { kNo, kAdvise };
+
+template <typename T>
+struct AlignedDelete;
+
+// Frees what MakeUniqueAligned / MakeUniqueForOverwrite allocated.
+template <typename T>
+struct AlignedDelete<T[]> {
+    void operator()(T* ptr, size_t size) const {
+        std::destroy_n(ptr, size);
+        std::free(ptr);
+    }
+};
+
+namespace unique_detail {
+
+// Allocates room for `size` elements at `alignment` (a power of two) and constructs them. With
+// HugePages::kAdvise, buffers of at least kHugePageSize are aligned to it and, where the platform
+// has MADV_HUGEPAGE, marked for transparent huge pages before they are first touched.
+template <typename T>
+T* AllocateAligned(size_t size, size_t alignment, HugePages huge_pages, bool value_init) {
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        throw std::invalid_argument("alignment must be a power of two");
+    }
+    if (size > SIZE_MAX / sizeof(T)) {
+        throw std::bad_array_new_length();
+    }
+    if (alignment < alignof(T)) {
+        alignment = alignof(T);
+    }
+    size_t bytes = size * sizeof(T);
+    if (huge_pages == HugePages::kAdvise && bytes >= kHugePageSize && alignment < kHugePageSize) {
+        alignment = kHugePageSize;
+    }
+    // aligned_alloc wants a multiple of the alignment.
+    if (bytes > SIZE_MAX - alignment) {
+        throw std::bad_array_new_length();
+    }
+    bytes = (bytes + alignment - 1) / alignment * alignment;
+    if (bytes == 0) {
+        bytes = alignment;
+    }
+
+    void* memory = std::aligned_alloc(alignment, bytes);
+    if (memory == nullptr) {
+        throw std::bad_alloc();
+    }
+#ifdef MADV_HUGEPAGE
+    if (huge_pages == HugePages::kAdvise && alignment >= kHugePageSize) {
+        madvise(memory, bytes, MADV_HUGEPAGE);
+    }
+#endif
+
+    T* elements = static_cast<T*>(memory);
+    try {
+        if (value_init) {
+            std::uninitialized_value_construct_n(elements, size);
+        } else {
+            std::uninitialized_default_construct_n(elements, size);
+        }
+    } catch (...) {
+        std::free(memory);
+        throw;
+    }
+    return elements;
+};
+
+}  // namespace unique_detail
+
+// Value-initialized array of `size` elements aligned to `alignment`.
+template <typename T>
+std::enable_if_t<std::is_array_v<T> && std::extent_v<T> == 0, UniquePtr<T, AlignedDelete<T>>>
+MakeUniqueAligned(size_t size, size_t alignment = kSimdAlignment,
+                  HugePages huge_pages = HugePages::kNo) {
+    using Element = std::remove_extent_t<T>;
+    return UniquePtr<T, AlignedDelete<T>>(
+        unique_detail::AllocateAligned<Element>(size, alignment, huge_pages, true), size);
+};
+
+// Like MakeUniqueAligned, but the elements are default-initialized: left as garbage for
+// trivial types, which is what a buffer about to be overwritten wants.
+template <typename T>
+std::enable_if_t<std::is_array_v<T> && std::extent_v<T> == 0, UniquePtr<T, AlignedDelete<T>>>
+MakeUniqueForOverwrite(size_t size, size_t alignment = kSimdAlignment,
+                       HugePages huge_pages = HugePages::kNo) {
+    using Element = std::remove_extent_t<T>;
+    return UniquePtr<T, AlignedDelete<T>>(
+        unique_detail::AllocateAligned<Element>(size, alignment, huge_pages, false), size);
 };
@@ -0,0 +1,186 @@
+#pragma once
+
+#include "shared.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <unordered_map>
+#include <utility>
+
+// Interning cache for immutable objects (strings, schemas, compiled regexes): GetOrCreate hands
+// out the one live object for a key, and the cache itself never keeps an object alive.
+//
+// The values are made by the cache, in a control block of its own whose kDestroyObject step
+// erases the entry once the object is gone. So there are no expired entries to scan for: an entry
+// lives exactly as long as its object, plus the moment between the last owner dropping it and the
+// hook taking the shard lock. Lookups that land in that moment see a failed lock and replace the
+// entry, the late hook then finds someone else's block under the key and leaves it alone.
+//
+// Keys are spread over independently locked shards. The factory runs outside the lock, so a slow
+// one holds up nobody; two threads missing on the same key may both run it, the loser's object is
+// dropped and the winner's returned to both. Values may outlive the cache.
+
+struct WeakValueCacheStats {
+    size_t hits = 0;       // GetOrCreate calls answered by a live entry
+    size_t misses = 0;     // GetOrCreate calls that ran the factory
+    size_t evictions = 0;  // entries erased by their object's destruction
+};
+
+template <typename K, typename T, typename Hash = std::hash<K>,
+          typename KeyEqual = std::equal_to<K>>
+class WeakValueCache {
+    struct Block;
+
+    struct alignas(kCacheLineSize) Shard {
+        std::mutex mutex;
+        std::unordered_map<K, Block*, Hash, KeyEqual> entries;
+        WeakValueCacheStats stats;
+
+        // The expiry hook. The entry may have been replaced by a newer block for the same key.
+        void Evict(const K& key, Block* block) {
+            std::lock_guard guard(mutex);
+            auto it = entries.find(key);
+            if (it != entries.end() && it->second == block) {
+                entries.erase(it);
+                ++stats.evictions;
+            }
+        }
+    };
+
+    // The object sits after the key, the block keeps its shard (and with it every shard) alive.
+    struct Block : public ControlBlockBase {
+        template <typename Factory>
+        Block(SharedPtr<Shard> shard, const K& key, Factory& factory)
+            : ControlBlockBase(OpsFor<&Manage, T>(CountPolicy::kAtomic)),
+              shard(std::move(shard)),
+              key(key) {
+            ::new (static_cast<void*>(&storage[0])) T(factory());
+            RecordCreated();
+        };
+
+        static void Manage(ControlBlockBase* base, BlockOp op) {
+            auto* self = static_cast<Block*>(base);
+            if (op == BlockOp::kDestroyObject) {
+                // The destructor may drop other values of this cache, so it runs without the lock
+                std::destroy_at(self->GetPtr());
+                self->shard->Evict(self->key, self);
+                self->shard.Reset();
+            } else {
+                delete self;
+            }
+        }
+
+        T* GetPtr() {
+            return std::launder(reinterpret_cast<T*>(&storage[0]));
+        }
+
+        SharedPtr<Shard> shard;
+        K key;
+        alignas(T) unsigned char storage[sizeof(T)];
+    };
+
+public:
+    static constexpr size_t kDefaultShards = 16;
+
+    // `shards` is rounded up to a power of two
+    explicit WeakValueCache(size_t shards = kDefaultShards) {
+        while ((size_t(1) << shard_bits_) < shards) {
+            ++shard_bits_;
+        }
+        shards_ = MakeShared<Shard[]>(size_t(1) << shard_bits_);
+    };
+
+    WeakValueCache(const WeakValueCache&) = delete;
+    WeakValueCache& operator=(const WeakValueCache&) = delete;
+
+    // The live object for `key`, or a new one made by `factory()`, which returns a T.
+    template <typename Factory>
+    SharedPtr<T> GetOrCreate(const K& key, Factory&& factory) {
+        size_t index = ShardIndex(key);
+        Shard& shard = shards_[index];
+        {
+            std::lock_guard guard(shard.mutex);
+            auto it = shard.entries.find(key);
+            if (it != shard.entries.end() && it->second->IncStrongIfNonZero()) {
+                ++shard.stats.hits;
+                return Adopt(it->second);
+            }
+        }
+
+        auto* block = new Block(SharedPtr<Shard>(shards_, &shard), key, factory);
+        SharedPtr<T> created = Adopt(block);
+        SharedPtr<T> winner;
+        {
+            std::lock_guard guard(shard.mutex);
+            auto [it, inserted] = shard.entries.try_emplace(key, block);
+            if (inserted || !it->second->IncStrongIfNonZero()) {
+                it->second = block;
+                ++shard.stats.misses;
+                return created;
+            }
+            ++shard.stats.hits;
+            winner = Adopt(it->second);
+        }
+        // `created` goes here, outside the lock its hook takes
+        return winner;
+    };
+
+    // The live object for `key`, empty if there is none. Never creates one.
+    SharedPtr<T> Get(const K& key) const {
+        Shard& shard = shards_[ShardIndex(key)];
+        std::lock_guard guard(shard.mutex);
+        auto it = shard.entries.find(key);
+        if (it != shard.entries.end() && it->second->IncStrongIfNonZero()) {
+            return Adopt(it->second);
+        }
+        return SharedPtr<T>();
+    };
+
+    // Entries, including ones whose object is being destroyed right now
+    size_t Size() const {
+        size_t size = 0;
+        for (size_t i = 0; i < ShardCount(); ++i) {
+            std::lock_guard guard(shards_[i].mutex);
+            size += shards_[i].entries.size();
+        }
+        return size;
+    };
+
+    WeakValueCacheStats Stats() const {
+        WeakValueCacheStats total;
+        for (size_t i = 0; i < ShardCount(); ++i) {
+            std::lock_guard guard(shards_[i].mutex);
+            total.hits += shards_[i].stats.hits;
+            total.misses += shards_[i].stats.misses;
+            total.evictions += shards_[i].stats.evictions;
+        }
+        return total;
+    };
+
+    size_t ShardCount() const {
+        return size_t(1) << shard_bits_;
+    };
+
+private:
+    SharedPtr<Shard[]> shards_;
+    int shard_bits_ = 0;
+    Hash hash_;
+
+    // Fibonacci hashing: takes the top bits, so identity hashes of small integers spread too
+    size_t ShardIndex(const K& key) const {
+        if (shard_bits_ == 0) {
+            return 0;
+        }
+        uint64_t mixed = static_cast<uint64_t>(hash_(key)) * 0x9E3779B97F4A7C15ull;
+        return static_cast<size_t>(mixed >> (64 - shard_bits_));
+    }
+
+    // Takes over the strong reference the caller holds on `block`
+    static SharedPtr<T> Adopt(Block* block) {
+        return SharedPtr<T>(block, block->GetPtr());
+    }
+};